@@ -0,0 +1,205 @@
+/*
+ * Copyright 2015 The University of Adelaide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "llcmap.h"
+#include "topology.h"
+#include "analyze.h"
+
+#define PM_PAGE		4096
+#define PM_PRESENT	(1ULL << 63)
+#define PM_PFN		((1ULL << 55) - 1)
+#define PM_BATCH	512
+
+struct range {
+  uint64_t start, end;
+  uint64_t hot;   /*referenced kB, for picking the hottest*/
+};
+
+static int parseranges(const char *s, struct range *r, int max) {
+  int n = 0;
+  while (n < max && *s) {
+    unsigned long long start, end;
+    int len;
+    if (sscanf(s, "%llx-%llx%n", &start, &end, &len) != 2 || end <= start)
+      return -1;
+    r[n].start = start;
+    r[n].end = end;
+    r[n].hot = 0;
+    n++;
+    s += len;
+    if (*s == ',')
+      s++;
+  }
+  return n;
+}
+
+// The max mappings with the most referenced memory
+static int hotranges(int pid, struct range *r, int max) {
+  char name[64];
+  sprintf(name, "/proc/%d/smaps", pid);
+  FILE *f = fopen(name, "r");
+  if (f == NULL) {
+    perror(name);
+    return -1;
+  }
+  int n = 0;
+  struct range cur = { 0, 0, 0 };
+  char line[1024];
+  while (fgets(line, sizeof(line), f) != NULL) {
+    unsigned long long start, end, kb;
+    if (sscanf(line, "%llx-%llx ", &start, &end) == 2) {
+      cur.start = start;
+      cur.end = end;
+    } else if (sscanf(line, "Referenced: %llu kB", &kb) == 1 && kb > 0) {
+      cur.hot = kb;
+      int slot = n;
+      if (n == max) {
+	slot = 0;
+	for (int i = 1; i < n; i++)
+	  if (r[i].hot < r[slot].hot)
+	    slot = i;
+	if (r[slot].hot >= cur.hot)
+	  continue;
+      } else
+	n++;
+      r[slot] = cur;
+    }
+  }
+  fclose(f);
+  return n;
+}
+
+int analyze(FILE *out, int pid, const char *ranges, llcmap_t *maps, int nmaps) {
+  struct range r[64];
+  int nr = ranges != NULL ? parseranges(ranges, r, 64) : hotranges(pid, r, ANALYZE_NHOT);
+  if (nr <= 0) {
+    fprintf(stderr, "analyze: no address ranges\n");
+    return -1;
+  }
+  char name[64];
+  sprintf(name, "/proc/%d/pagemap", pid);
+  int f = open(name, O_RDONLY);
+  if (f < 0) {
+    perror(name);
+    return -1;
+  }
+
+  // the hash only covers memory if the buffer varies every bit below its top
+  uint64_t physmem = (uint64_t)sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+  uint64_t physbits = physmem > 1 ? ~0ULL >> __builtin_clzll(physmem - 1) : 0;
+  uint64_t *lines[nmaps];
+  for (int m = 0; m < nmaps; m++) {
+    llcmap_inferhash(maps[m]);
+    if (maps[m]->hashbits == 0)
+      fprintf(stderr, "analyze: socket %d: no XOR hash fits the map\n", maps[m]->socket);
+    else if (((maps[m]->hashvarying | (LLCMAP_CLSIZE - 1)) & physbits) != physbits)
+      fprintf(stderr, "analyze: socket %d: the buffer only varies address bits 0x%llx, lines differing from it elsewhere are unknown\n",
+	  maps[m]->socket, (unsigned long long)maps[m]->hashvarying);
+    lines[m] = calloc(maps[m]->ncores + 1, sizeof(uint64_t));
+  }
+  uint64_t resident = 0, pages = 0, hidden = 0;
+  uint64_t buf[PM_BATCH];
+  for (int i = 0; i < nr; i++) {
+    fprintf(out, "range %012llx-%012llx\n", (unsigned long long)r[i].start, (unsigned long long)r[i].end);
+    for (uint64_t va = r[i].start & ~(uint64_t)(PM_PAGE - 1); va < r[i].end; va += PM_BATCH * PM_PAGE) {
+      ssize_t got = pread(f, buf, sizeof(buf), va / PM_PAGE * sizeof(uint64_t));
+      for (int j = 0; j < got / (ssize_t)sizeof(uint64_t) && va + j * PM_PAGE < r[i].end; j++) {
+	pages++;
+	if (!(buf[j] & PM_PRESENT))
+	  continue;
+	if ((buf[j] & PM_PFN) == 0) {
+	  hidden++;
+	  continue;
+	}
+	resident++;
+	uint64_t pa = (buf[j] & PM_PFN) * PM_PAGE;
+	for (uint64_t off = 0; off < PM_PAGE; off += LLCMAP_CLSIZE)
+	  for (int m = 0; m < nmaps; m++) {
+	    int s = llcmap_slice(maps[m], pa + off);
+	    lines[m][s < 0 ? maps[m]->ncores : s]++;
+	  }
+      }
+    }
+  }
+  close(f);
+  fprintf(out, "pid %d: %llu of %llu pages resident\n", pid, (unsigned long long)resident, (unsigned long long)pages);
+  if (hidden > 0)
+    fprintf(stderr, "analyze: %llu pages without frames, reading pagemap needs CAP_SYS_ADMIN\n", (unsigned long long)hidden);
+  if (resident == 0)
+    return -1;
+  uint64_t resolved = 0;
+  for (int m = 0; m < nmaps; m++)
+    for (int s = 0; s < maps[m]->ncores; s++)
+      resolved += lines[m][s];
+  if (resolved == 0) {
+    fprintf(stderr, "analyze: no line could be resolved to a slice, -a needs a map of a buffer on scattered frames\n"
+	"(map with -b not a multiple of 1GB, so the buffer is not on 1GB pages)\n");
+    for (int m = 0; m < nmaps; m++)
+      free(lines[m]);
+    return -1;
+  }
+
+  topo_init();
+  for (int m = 0; m < nmaps; m++) {
+    llcmap_t map = maps[m];
+    int n = map->ncores;
+    uint64_t known = 0;
+    for (int s = 0; s < n; s++)
+      known += lines[m][s];
+    fprintf(out, "socket %d slices:", map->socket);
+    for (int s = 0; s < n; s++)
+      fprintf(out, " %d:%.1f%%", s, known ? 100.0 * lines[m][s] / known : 0.0);
+    fprintf(out, " unknown:%llu\n", (unsigned long long)lines[m][n]);
+    if (known == 0)
+      continue;
+
+    // mean hit latency from each core, best first
+    double lat[n];
+    int order[n];
+    for (int c = 0; c < n; c++) {
+      lat[c] = 0;
+      for (int s = 0; s < n; s++)
+	lat[c] += (double)lines[m][s] * map->latency[c * n + s] / 10 / known;
+      int i = c;
+      while (i > 0 && lat[order[i - 1]] > lat[c]) {
+	order[i] = order[i - 1];
+	i--;
+      }
+      order[i] = c;
+    }
+    struct socketinfo *si = NULL;
+    for (int s = 0; s < topo_nsockets(); s++)
+      if (topo_socket(s)->id == map->socket)
+	si = topo_socket(s);
+    fprintf(out, "socket %d cores:", map->socket);
+    for (int i = 0; i < n; i++)
+      fprintf(out, " %d(cpu %d):%.1f", order[i], si && order[i] < si->ncores ? si->cpus[order[i]] : -1, lat[order[i]]);
+    fprintf(out, "\n");
+    if (si != NULL && order[0] < si->ncores)
+      fprintf(out, "socket %d suggest: taskset -pc %d %d\n", map->socket, si->cpus[order[0]], pid);
+  }
+  for (int m = 0; m < nmaps; m++)
+    free(lines[m]);
+  return 0;
+}
@@ -0,0 +1,30 @@
+/*
+ * Copyright 2015 The University of Adelaide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __ANALYZE_H__
+#define __ANALYZE_H__ 1
+
+// Num of mappings from /proc/PID/smaps analysed when no ranges are given
+#define ANALYZE_NHOT	8
+
+/*
+ * Reports the LLC slice distribution of the resident lines of pid in ranges
+ * ("start-end,start-end" in hex), or in its most referenced mappings, and
+ * ranks each socket's cores by their mean hit latency to those lines.
+ */
+int analyze(FILE *out, int pid, const char *ranges, llcmap_t *maps, int nmaps);
+
+#endif // __ANALYZE_H__
@@ -20,70 +20,292 @@
 #include <stdlib.h>
 #include <sys/mman.h>
 #include <sched.h>
+#include <unistd.h>
 
 
 #include "probe.h"
 #include "timestats.h"
 #include "sysinfo.h"
+#include "sim.h"
+#include "topology.h"
+#include "llcmap.h"
+#include "analyze.h"
+#include "profile.h"
+#include "service.h"
 
 int debug = 0;
 
+static char *backing = NULL;
+static char *mapin = NULL;
+static char *mapout = NULL;
+static char *simspec = NULL;
+static uint64_t ebsize = EBSIZE;
+static int first = 0, last = -1;
+static int pid = 0;
+static char *ranges = NULL;
+static char *servename = NULL, *queryname = NULL;
+static int lazycount = 0;
+static double confidence = 0, tolerance = 0.01;
+static int profileonly = 0, autotune = 0, characterize = 0, helper = 0;
+
 void init() {
-  probe_init(EBSIZE);
+  if (simspec != NULL) {
+    struct simconfig sc;
+    sim_defaults(&sc);
+    if (sim_parse(&sc, simspec) < 0) {
+      fprintf(stderr, "Bad simulator config '%s'\n", simspec);
+      exit(1);
+    }
+    probe_setsim(&sc);
+  }
+  if (backing != NULL)
+    probe_setbacking(backing);
+  probe_sethelper(helper);
+  probe_init(ebsize);
+  if (characterize) {
+    struct evictpattern pat;
+    if (probe_characterize(stderr, &pat) < 0)
+      fprintf(stderr, "No reliable eviction pattern found, keeping the default\n");
+    else
+      probe_setpattern(&pat);
+  }
+}
+
+void usage(char *name) {
+  fprintf(stderr, "Usage: %s [-f hugetlbfs-file] [-l map-in] [-o map-out] [-b MB] [-s first[-last]] [-S sim-config]\n", name);
+  fprintf(stderr, "  -f  back the eviction buffers with <file>-<socket> on a 1GB hugetlbfs mount,\n");
+  fprintf(stderr, "      one process at a time\n");
+  fprintf(stderr, "  -l  reuse a stored map where the buffer frames are unchanged\n");
+  fprintf(stderr, "  -o  write the map to a file instead of stdout\n");
+  fprintf(stderr, "  -b  eviction buffer size per socket\n");
+  fprintf(stderr, "  -s  map only set indices first to last\n");
+  fprintf(stderr, "  -V  with -l, verify random lines of the map and remap failing set indices,\n");
+  fprintf(stderr, "      e.g. -V 0.99/0.01 for 99%% confidence that under 1%% of lines are wrong\n");
+  fprintf(stderr, "  -S  map a simulated LLC, e.g. slices=4,ways=16,policy=lru|fifo|random|srrip,\n");
+  fprintf(stderr, "      hash=<hex>:<hex>,hit=40,hop=2,miss=200,noise=4,outliers=0,seed=1\n");
+  fprintf(stderr, "  -H  walk half of each eviction set on the sibling hyperthread\n");
+  fprintf(stderr, "  -R  find the cheapest access pattern that evicts reliably and map with it\n");
+  fprintf(stderr, "  -A  profile the memory hierarchy first and size the threshold and buffer from it\n");
+  fprintf(stderr, "       %s -P\n", name);
+  fprintf(stderr, "  -P  print latency percentiles and cache levels for 4KB, 2MB and 1GB pages\n");
+  fprintf(stderr, "       %s -l map-in -a pid [-r start-end,...]\n", name);
+  fprintf(stderr, "  -a  report the slices of pid's hottest mappings, or of -r ranges, and the closest cores\n");
+  fprintf(stderr, "  -L  map only the set indices of n random lines of a fresh buffer and print their slices\n");
+  fprintf(stderr, "  -D  after mapping, publish the map in shared memory /<name> and answer queries\n");
+  fprintf(stderr, "      on " SERVICE_SOCKDIR "/<name>.sock\n");
+  fprintf(stderr, "       %s -Q name\n", name);
+  fprintf(stderr, "  -Q  look up lines of 'p <hex> [socket]' or 'v <hex> [socket]' from stdin in a service\n");
+  exit(1);
 }
 
-void *allocpage() {
-  void *rv = mmap(NULL, 4096, PROT_READ|PROT_WRITE, MAP_ANON|MAP_SHARED, -1, 0);
-  if (rv == MAP_FAILED) {
-    perror("allocpage: mmap");
+// Returns non-zero if a verified map did not pass or the simulator disagrees
+int map() {
+  int rv = 0;
+  if (mapin != NULL) {
+    FILE *f = fopen(mapin, "r");
+    if (f == NULL) {
+      perror(mapin);
+      exit(1);
+    }
+    probe_loadmap(f);
+    fclose(f);
+  }
+  if (confidence > 0)
+    rv = probe_verify(confidence, tolerance) > 0;
+  else
+    probe_map(first, last < 0 ? probe_noffsets() - 1 : last);
+  if (simspec != NULL && probe_simcheck() > 0)
+    rv = 1;
+  FILE *f = stdout;
+  if (mapout != NULL && (f = fopen(mapout, "w")) == NULL) {
+    perror(mapout);
     exit(1);
   }
+  probe_writemap(f);
+  if (f != stdout)
+    fclose(f);
   return rv;
 }
 
+// One random line of each of lazycount pages, non-zero if the simulator disagrees
+int lookup() {
+  int n = lazycount;
+  char *buf = mmap(NULL, (size_t)n * 4096, PROT_READ|PROT_WRITE, MAP_ANON|MAP_PRIVATE, -1, 0);
+  if (buf == MAP_FAILED) {
+    perror("lookup: mmap");
+    exit(1);
+  }
+  void *addrs[n];
+  for (int i = 0; i < n; i++) {
+    addrs[i] = buf + (size_t)i * 4096 + random() % 64 * 64;
+    *(volatile char *)addrs[i] = 1;
+  }
+  int ns = probe_nsockets();
+  int *slices = malloc(n * ns * sizeof(int));
+  int found = probe_slices(addrs, n, slices);
+  int wrong = 0;
+  for (int i = 0; i < n; i++) {
+    printf("%p", addrs[i]);
+    for (int s = 0; s < ns; s++)
+      printf(" %d", slices[s * n + i]);
+    printf("\n");
+    if (simspec != NULL && slices[i] >= 0 && slices[i] != sim_slice(addrs[i]))
+      wrong++;
+  }
+  fprintf(stderr, "%d of %d lines found\n", found, n * ns);
+  if (simspec != NULL)
+    fprintf(stderr, "sim: %d of %d lines in the wrong slice\n", wrong, n);
+  free(slices);
+  return wrong > 0;
+}
+
+void serve() {
+  llcmap_t maps[MAX_SOCKETS];
+  int nmaps = 0;
+  while (nmaps < MAX_SOCKETS && (maps[nmaps] = probe_llcmap(nmaps)) != NULL)
+    nmaps++;
+  service_run(servename, maps, nmaps);
+}
+
+// Physical addresses are looked up in the segment, virtual ones by the server
+void query() {
+  service_t s = service_open(queryname);
+  int fd = service_connect(queryname);
+  if (s == NULL && fd < 0) {
+    fprintf(stderr, "%s: no service\n", queryname);
+    exit(1);
+  }
+  char line[256];
+  while (fgets(line, sizeof(line), stdin) != NULL) {
+    char kind;
+    unsigned long long addr;
+    int map = 0;
+    if (sscanf(line, " %c %llx %d", &kind, &addr, &map) < 2 || (kind != 'p' && kind != 'v'))
+      continue;
+    int slice = -1;
+    if (kind == 'p' && s != NULL)
+      slice = service_slice(s, map, addr);
+    else if (fd >= 0)
+      slice = service_query(fd, map, addr, kind == 'v');
+    printf("%c 0x%llx %d %d\n", kind, addr, map, slice);
+  }
+  service_close(s);
+  exit(0);
+}
+
+void analyzepid() {
+  if (mapin == NULL)
+    usage("cachemap");
+  FILE *f = fopen(mapin, "r");
+  if (f == NULL) {
+    perror(mapin);
+    exit(1);
+  }
+  llcmap_t maps[MAX_SOCKETS];
+  int nmaps = 0;
+  while (nmaps < MAX_SOCKETS && (maps[nmaps] = llcmap_read(f, probe_pagesize())) != NULL)
+    nmaps++;
+  fclose(f);
+  if (nmaps == 0) {
+    fprintf(stderr, "%s: no map\n", mapin);
+    exit(1);
+  }
+  int rv = analyze(stdout, pid, ranges, maps, nmaps);
+  for (int i = 0; i < nmaps; i++)
+    llcmap_free(maps[i]);
+  exit(rv < 0);
+}
 
+// Working sets up to PROFILE_LLCMULT times the LLC
+#define PROFILE_LLCMULT	4
+#define PROFILE_DEFAULT	(32 * MB)
+
+void profilemem() {
+  uint64_t llc = topo_llcsize();
+  struct profile pf;
+  int rv = profile(profileonly ? stdout : stderr, PROFILE_LLCMULT * (llc ? llc : PROFILE_DEFAULT), &pf);
+  if (profileonly)
+    exit(rv < 0);
+  if (rv < 0) {
+    fprintf(stderr, "No LLC level found, keeping defaults\n");
+    return;
+  }
+  if (llc && profile_nearest(&pf, llc) < 0) {
+    fprintf(stderr, "No level near the %lluKB LLC sysfs reports, keeping defaults\n", (unsigned long long)(llc / KB));
+    return;
+  }
+  // split needs more than nways lines of every slice
+  int ncores = 0, nsockets = topo_init();
+  for (int s = 0; s < nsockets; s++)
+    if (topo_socket(s)->ncores > ncores)
+      ncores = topo_socket(s)->ncores;
+  uint64_t minsize = (uint64_t)ncores * topo_nways() * probe_pagesize();
+  probe_setthreshold(profile_threshold(&pf));
+  ebsize = profile_ebsize(&pf);
+  if (ebsize < minsize)
+    ebsize = (minsize + 2 * MB - 1) / (2 * MB) * (2 * MB);
+  fprintf(stderr, "LLC %lluKB %d cycles, memory %d cycles: threshold %d, buffer %lluMB\n",
+      (unsigned long long)(pf.levels[pf.llc].size / KB), pf.levels[pf.llc].latency,
+      pf.dram, profile_threshold(&pf), (unsigned long long)(ebsize / MB));
+}
 
 int main(int c, char **v) {
+  int opt;
+  while ((opt = getopt(c, v, "f:l:o:b:s:S:a:r:V:D:Q:L:PARH")) != -1) {
+    switch (opt) {
+      case 'f': backing = optarg; break;
+      case 'l': mapin = optarg; break;
+      case 'o': mapout = optarg; break;
+      case 'b': ebsize = strtoull(optarg, NULL, 0) * MB; break;
+      case 's':
+	if (sscanf(optarg, "%i-%i", &first, &last) == 1)
+	  last = first;
+	break;
+      case 'S': simspec = optarg; break;
+      case 'a': pid = atoi(optarg); break;
+      case 'r': ranges = optarg; break;
+      case 'D': servename = optarg; break;
+      case 'Q': queryname = optarg; break;
+      case 'L': lazycount = atoi(optarg); break;
+      case 'P': profileonly = 1; break;
+      case 'A': autotune = 1; break;
+      case 'R': characterize = 1; break;
+      case 'H': helper = 1; break;
+      case 'V':
+	sscanf(optarg, "%lf/%lf", &confidence, &tolerance);
+	if (confidence <= 0 || confidence >= 1 || tolerance <= 0 || tolerance >= 1)
+	  usage(v[0]);
+	break;
+      default: usage(v[0]);
+    }
+  }
+  if (pid != 0)
+    analyzepid();
+  if (queryname != NULL)
+    query();
+  if (confidence > 0 && mapin == NULL)
+    usage(v[0]);
+  if (autotune && simspec != NULL) {
+    fprintf(stderr, "-A tunes for the hardware, not a simulated LLC\n");
+    exit(1);
+  }
   //srandom(time(NULL));
   cpu_set_t cs;
   CPU_ZERO(&cs);
   CPU_SET(0, &cs);
-  if (sched_setaffinity(0, sizeof(cs), &cs) < 0) {
+  if (simspec == NULL && sched_setaffinity(0, sizeof(cs), &cs) < 0) {
     perror("migrate0");
     exit(1);
   }
 
   setbuf(stdout, NULL);
+  if (profileonly || autotune)
+    profilemem();
   init();
-  exit(0);
-  if (debug) fprintf(stderr, "init\n");
-
-  ts_t flush = ts_alloc();
-  void *p = allocpage();
-  if (debug) fprintf(stderr, "allocpage\n");
-  for (int i = 0; i < 1000000; i++)  {
-    probe_clflush(p);
-    ts_add(flush, probe_time(p));
-  }
-  if (debug)fprintf(stderr, "flush\n");
-
-  int si = probe_setindex(p);
-  ts_t evict = ts_alloc();
-  for (int i = 0; i < 1000000; i++)  {
-    probe_evict(si);
-    probe_evict(si);
-    probe_evict(si);
-    ts_add(evict, probe_time(p));
-    /*if (i % 1000 == 999)
-      fputc('.', stderr); */
-    
-  }
-  if (debug)fprintf(stderr, "evict\n");
-
-  printf("#time flush evict\n");
-  for (int i = 1; i < TIME_MAX; i++) 
-    printf("%d %d %d\n", i, ts_get(flush, i), ts_get(evict, i));
-
+  if (lazycount > 0)
+    exit(lookup());
+  int rv = map();
+  if (servename != NULL)
+    serve();
+  exit(rv);
 }
-
-
@@ -0,0 +1,106 @@
+/*
+ * Copyright 2015 The University of Adelaide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __KERNELS_H__
+#define __KERNELS_H__ 1
+
+/*
+ * Generators for eviction and measurement kernels unrolled for a fixed
+ * eviction-set length.  The list must be exactly len nodes long, there is
+ * no NULL check in the unrolled walk.  Instantiate with
+ * KERNEL_SIZES(DEFINE_KERNEL) and DEFINE_CHUNKED_KERNEL where cacheline_t,
+ * hw_access, hw_time and ts_add are visible.  The kernels always measure
+ * the hardware.
+ */
+
+// Associativities (11, 12, 16, 20), quick sets of ways + 5 and acctime's 10
+#define KERNEL_SIZES(X)	X(10) X(11) X(12) X(16) X(17) X(20) X(21) X(25)
+
+#define KREP_1(x)	x
+#define KREP_2(x)	KREP_1(x) x
+#define KREP_3(x)	KREP_2(x) x
+#define KREP_4(x)	KREP_3(x) x
+#define KREP_5(x)	KREP_4(x) x
+#define KREP_6(x)	KREP_5(x) x
+#define KREP_7(x)	KREP_6(x) x
+#define KREP_8(x)	KREP_7(x) x
+#define KREP_9(x)	KREP_8(x) x
+#define KREP_10(x)	KREP_9(x) x
+#define KREP_11(x)	KREP_10(x) x
+#define KREP_12(x)	KREP_11(x) x
+#define KREP_13(x)	KREP_12(x) x
+#define KREP_14(x)	KREP_13(x) x
+#define KREP_15(x)	KREP_14(x) x
+#define KREP_16(x)	KREP_15(x) x
+#define KREP_17(x)	KREP_16(x) x
+#define KREP_18(x)	KREP_17(x) x
+#define KREP_19(x)	KREP_18(x) x
+#define KREP_20(x)	KREP_19(x) x
+#define KREP_21(x)	KREP_20(x) x
+#define KREP_22(x)	KREP_21(x) x
+#define KREP_23(x)	KREP_22(x) x
+#define KREP_24(x)	KREP_23(x) x
+#define KREP_25(x)	KREP_24(x) x
+#define KREP_26(x)	KREP_25(x) x
+#define KREP_27(x)	KREP_26(x) x
+#define KREP_28(x)	KREP_27(x) x
+#define KREP_29(x)	KREP_28(x) x
+#define KREP_30(x)	KREP_29(x) x
+#define KREP_31(x)	KREP_30(x) x
+#define KREP_32(x)	KREP_31(x) x
+
+// Eviction and timed loops around walk_##name
+#define DEFINE_LOOPS(name)						\
+static void evict_##name(cacheline_t cl, int len, int link, int passes) { \
+  for (int j = passes; j--; )						\
+    walk_##name(cl, len, link);						\
+}									\
+									\
+static void measure_##name(cacheline_t cc, cacheline_t cl, int len, int link, int passes, ts_t ts, int count) { \
+  for (int i = 0; i < count; i++) {					\
+    hw_access(cc);							\
+    for (int j = passes; j--; )						\
+      walk_##name(cl, len, link);					\
+    ts_add(ts, hw_time(cc));						\
+  }									\
+}
+
+// The empty asm keeps the last load of the chain live
+#define DEFINE_KERNEL(n)						\
+static inline __attribute__((always_inline))				\
+void walk_##n(cacheline_t cl, int len, int link) {			\
+  KREP_##n(cl = cl->cl_links[link];)					\
+  asm __volatile__ ("" : : "r" (cl));					\
+}									\
+DEFINE_LOOPS(n)
+
+// Any other length, in unrolled blocks of KERNEL_CHUNK lines and then the rest
+#define KERNEL_CHUNK	8
+#define DEFINE_CHUNKED_KERNEL						\
+static inline __attribute__((always_inline))				\
+void walk_chunked(cacheline_t cl, int len, int link) {			\
+  for (int i = len / KERNEL_CHUNK; i--; ) {				\
+    KREP_8(cl = cl->cl_links[link];)					\
+  }									\
+  for (int i = len % KERNEL_CHUNK; i--; )				\
+    cl = cl->cl_links[link];						\
+  asm __volatile__ ("" : : "r" (cl));					\
+}									\
+DEFINE_LOOPS(chunked)
+
+#define KERNEL_ENTRY(n)	{ n, evict_##n, measure_##n },
+
+#endif // __KERNELS_H__
@@ -0,0 +1,322 @@
+/*
+ * Copyright 2015 The University of Adelaide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "llcmap.h"
+
+// Samples used to fit the hash, and one in how many of them it may get wrong
+#define HASH_NSAMPLES	65536
+#define HASH_TOLERANCE	100
+
+llcmap_t llcmap_new(int socket, int node, int npages, int nlines, int pagesize, int ncores) {
+  llcmap_t rv = calloc(1, sizeof(struct llcmap));
+  rv->socket = socket;
+  rv->node = node;
+  rv->npages = npages;
+  rv->nlines = nlines;
+  rv->pagesize = pagesize;
+  rv->ncores = ncores;
+  rv->frames = calloc(npages, sizeof(uint64_t));
+  rv->slices = calloc(nlines, sizeof(char *));
+  rv->latency = calloc(ncores * ncores, sizeof(int));
+  rv->latcount = calloc(ncores * ncores, sizeof(int));
+  return rv;
+}
+
+void llcmap_free(llcmap_t m) {
+  if (m == NULL)
+    return;
+  for (int i = 0; i < m->nlines; i++)
+    free(m->slices[i]);
+  free(m->slices);
+  free(m->frames);
+  free(m->latency);
+  free(m->latcount);
+  free(m->byframe);
+  free(m);
+}
+
+/*
+ * One header line per socket, then the physical address of every page that
+ * does not follow on from the previous one (unknown runs are 0), then the
+ * latency from each core to each slice, then one row per set index with
+ * the slice of each page.
+ */
+void llcmap_write(FILE *f, llcmap_t m) {
+  fprintf(f, "socket %d node %d pages %d lines %d cores %d\n", m->socket, m->node, m->npages, m->nlines, m->ncores);
+  for (int p = 0; p < m->npages; p++)
+    if (p == 0 || (m->frames[p] != m->frames[p - 1] + m->pagesize && (m->frames[p] | m->frames[p - 1])))
+      fprintf(f, "frame %d 0x%016llx\n", p, (unsigned long long)m->frames[p]);
+  for (int c = 0; c < m->ncores; c++) {
+    fprintf(f, "latency %d", c);
+    for (int s = 0; s < m->ncores; s++)
+      fprintf(f, " %d", m->latency[c * m->ncores + s]);
+    fprintf(f, "\n");
+  }
+  for (int i = 0; i < m->nlines; i++) {
+    for (int p = 0; p < m->npages; p++)
+      putc(m->slices[i] == NULL ? '/' : '0' + m->slices[i][p], f);
+    putc('\n', f);
+  }
+}
+
+/*
+ * Reads one socket written by llcmap_write, pages without a frame line
+ * follow on from the previous page and unmapped rows are left NULL.  Returns NULL at end of file or on a
+ * malformed map.
+ */
+llcmap_t llcmap_read(FILE *f, int pagesize) {
+  int socket, node, npages, nlines, ncores;
+  if (fscanf(f, " socket %d node %d pages %d lines %d cores %d", &socket, &node, &npages, &nlines, &ncores) != 5)
+    return NULL;
+  if (npages <= 0 || nlines <= 0 || ncores <= 0)
+    return NULL;
+  llcmap_t rv = llcmap_new(socket, node, npages, nlines, pagesize, ncores);
+  char *given = calloc(npages, 1);
+  int page;
+  unsigned long long frame;
+  while (fscanf(f, " frame %d 0x%llx", &page, &frame) == 2) {
+    if (page < 0 || page >= npages)
+      goto bad;
+    rv->frames[page] = frame;
+    given[page] = 1;
+  }
+  for (int p = 1; p < npages; p++)
+    if (!given[p] && rv->frames[p - 1] != 0)
+      rv->frames[p] = rv->frames[p - 1] + pagesize;
+  int core;
+  while (fscanf(f, " latency %d", &core) == 1) {
+    if (core < 0 || core >= ncores)
+      goto bad;
+    for (int s = 0; s < ncores; s++) {
+      int *l = &rv->latency[core * ncores + s];
+      if (fscanf(f, "%d", l) != 1)
+	goto bad;
+      rv->latcount[core * ncores + s] = *l != 0;
+    }
+  }
+  for (int i = 0; i < nlines; i++) {
+    rv->slices[i] = malloc(npages);
+    if (i > 0 && getc(f) != '\n')
+      goto bad;
+    int mapped = 0;
+    for (int p = 0; p < npages; p++) {
+      int c = getc(f);
+      // '/' is -1, unmapped
+      if (c < '/' || c - '0' >= ncores)
+	goto bad;
+      rv->slices[i][p] = c - '0';
+      mapped |= c != '/';
+    }
+    if (!mapped) {
+      free(rv->slices[i]);
+      rv->slices[i] = NULL;
+    }
+  }
+  free(given);
+  llcmap_sortframes(rv);
+  return rv;
+
+bad:
+  free(given);
+  llcmap_free(rv);
+  return NULL;
+}
+
+void llcmap_addlatency(llcmap_t m, int core, int slice, int latency) {
+  if (core < 0 || core >= m->ncores || slice < 0 || slice >= m->ncores)
+    return;
+  int i = core * m->ncores + slice;
+  m->latcount[i]++;
+  m->latency[i] += (latency - m->latency[i]) / m->latcount[i];
+}
+
+static int hashvalue(llcmap_t m, uint64_t pa) {
+  int h = 0;
+  for (int i = 0; i < m->hashbits; i++)
+    h |= __builtin_parityll(pa & m->hash[i]) << i;
+  return h;
+}
+
+// Adds v to a GF(2) basis kept as one row per leading bit
+static void gf2insert(uint64_t *basis, uint64_t v) {
+  for (int b = 63; b >= 0 && v; b--) {
+    if (!(v >> b & 1))
+      continue;
+    if (basis[b] == 0) {
+      basis[b] = v;
+      return;
+    }
+    v ^= basis[b];
+  }
+}
+
+// Clears every leading bit from the other rows
+static void gf2reduce(uint64_t *basis) {
+  for (int c = 0; c < 64; c++)
+    if (basis[c])
+      for (int b = c - 1; b >= 0; b--)
+	if (basis[b] && (basis[c] >> b & 1))
+	  basis[c] ^= basis[b];
+}
+
+// Calls fn on every stride'th mapped line with a known physical address
+static void foreachsample(llcmap_t m, uint64_t stride, void (*fn)(llcmap_t, uint64_t, int, void *), void *arg) {
+  uint64_t n = 0;
+  for (int i = 0; i < m->nlines; i++) {
+    if (m->slices[i] == NULL)
+      continue;
+    for (int p = 0; p < m->npages; p++) {
+      int s = m->slices[i][p];
+      if (m->frames[p] == 0 || s < 0 || s >= m->ncores || n++ % stride)
+	continue;
+      fn(m, m->frames[p] + (uint64_t)i * LLCMAP_CLSIZE, s, arg);
+    }
+  }
+}
+
+struct fitstate {
+  uint64_t first;
+  uint64_t varying;
+  uint64_t kernel[64];
+  uint64_t *ref;
+  int *counts;
+};
+
+static void countsample(llcmap_t m, uint64_t pa, int s, void *arg) {
+  (*(uint64_t *)arg)++;
+}
+
+static void kernelsample(llcmap_t m, uint64_t pa, int s, void *arg) {
+  struct fitstate *fs = arg;
+  if (fs->first == 0)
+    fs->first = pa;
+  fs->varying |= pa ^ fs->first;
+  if (fs->ref[s] == 0)
+    fs->ref[s] = pa;
+  else
+    gf2insert(fs->kernel, pa ^ fs->ref[s]);
+}
+
+static void labelsample(llcmap_t m, uint64_t pa, int s, void *arg) {
+  struct fitstate *fs = arg;
+  fs->counts[hashvalue(m, pa) * m->ncores + s]++;
+}
+
+/*
+ * Two addresses share a slice when their XOR lies in the kernel of the hash.
+ * The XORs of same-slice lines span that kernel, and each varying address
+ * bit that does not lead a row of the reduced kernel basis gives one hash
+ * function orthogonal to it.  Each hash value is then labelled with the
+ * slice most of its lines map to.
+ */
+int llcmap_inferhash(llcmap_t m) {
+  m->hashbits = 0;
+  uint64_t total = 0;
+  foreachsample(m, 1, countsample, &total);
+  if (total == 0)
+    return -1;
+  uint64_t stride = total / HASH_NSAMPLES + 1;
+
+  struct fitstate fs;
+  memset(&fs, 0, sizeof(fs));
+  fs.ref = calloc(m->ncores, sizeof(uint64_t));
+  foreachsample(m, stride, kernelsample, &fs);
+  free(fs.ref);
+  gf2reduce(fs.kernel);
+
+  int bits = 0;
+  for (int f = 0; f < 64; f++) {
+    if (!(fs.varying >> f & 1) || fs.kernel[f])
+      continue;
+    if (bits == LLCMAP_MAXHASH)
+      return -1;
+    uint64_t mask = 1ULL << f;
+    for (int b = 0; b < 64; b++)
+      if (fs.kernel[b] >> f & 1)
+	mask |= 1ULL << b;
+    m->hash[bits++] = mask;
+  }
+  m->hashbits = bits;
+  m->hashref = fs.first;
+  m->hashvarying = fs.varying;
+
+  fs.counts = calloc((1 << bits) * m->ncores, sizeof(int));
+  foreachsample(m, stride, labelsample, &fs);
+  int wrong = 0, sampled = 0;
+  for (int h = 0; h < 1 << bits; h++) {
+    int *c = &fs.counts[h * m->ncores];
+    int best = -1, sum = 0;
+    for (int s = 0; s < m->ncores; s++) {
+      sum += c[s];
+      if (c[s] > 0 && (best < 0 || c[s] > c[best]))
+	best = s;
+    }
+    m->hashslice[h] = best;
+    sampled += sum;
+    if (best >= 0)
+      wrong += sum - c[best];
+  }
+  free(fs.counts);
+  if (wrong * HASH_TOLERANCE > sampled)
+    m->hashbits = 0;
+  return wrong;
+}
+
+static int framecmp(const void *v1, const void *v2, void *arg) {
+  llcmap_t m = arg;
+  uint64_t f1 = m->frames[*(int *)v1];
+  uint64_t f2 = m->frames[*(int *)v2];
+  return f1 < f2 ? -1 : f1 > f2;
+}
+
+void llcmap_sortframes(llcmap_t m) {
+  if (m->byframe == NULL)
+    m->byframe = malloc(m->npages * sizeof(int));
+  for (int p = 0; p < m->npages; p++)
+    m->byframe[p] = p;
+  qsort_r(m->byframe, m->npages, sizeof(int), framecmp, m);
+}
+
+int llcmap_slice(llcmap_t m, uint64_t pa) {
+  if (m->byframe == NULL)
+    return -1;
+  int lo = 0, hi = m->npages;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if (m->frames[m->byframe[mid]] <= pa)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo > 0) {
+    int p = m->byframe[lo - 1];
+    uint64_t off = pa - m->frames[p];
+    if (m->frames[p] != 0 && off < m->pagesize) {
+      int i = off / LLCMAP_CLSIZE % m->nlines;
+      if (m->slices[i] != NULL && m->slices[i][p] >= 0)
+	return m->slices[i][p];
+    }
+  }
+  if (m->hashbits == 0 || ((pa ^ m->hashref) & ~m->hashvarying & ~(uint64_t)(LLCMAP_CLSIZE - 1)))
+    return -1;
+  return m->hashslice[hashvalue(m, pa)];
+}
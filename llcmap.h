@@ -0,0 +1,66 @@
+/*
+ * Copyright 2015 The University of Adelaide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __LLCMAP_H__
+#define __LLCMAP_H__ 1
+
+#define LLCMAP_MAXHASH	8
+#define LLCMAP_CLSIZE	64
+
+/*slice map of one socket's eviction buffer, keyed by (socket, slice)*/
+struct llcmap {
+  int socket;        /*physical package id*/
+  int node;          /*NUMA node the buffer lives on*/
+  int npages;        /*num of set-index pages in the buffer*/
+  int nlines;        /*num of set indices in a page*/
+  int pagesize;      /*bytes in a set-index page*/
+  int ncores;        /*num of cores, and of slices*/
+  uint64_t *frames;  /*physical address of each page, 0 if unknown*/
+  char **slices;     /*slices[setindex][page], -1 if unmapped*/
+  int *latency;      /*latency[core * ncores + slice] in tenths of a cycle, 0 if unknown*/
+  int *latcount;     /*set indices averaged into each latency*/
+  int *byframe;      /*pages sorted by frame, built on first lookup*/
+
+  /*XOR hash fitted to the map, hashbits is 0 if none fits*/
+  int hashbits;
+  uint64_t hash[LLCMAP_MAXHASH];
+  char hashslice[1 << LLCMAP_MAXHASH];
+  uint64_t hashref;      /*a mapped line, addresses may differ from it...*/
+  uint64_t hashvarying;  /*...only in the bits that vary across the buffer*/
+};
+
+typedef struct llcmap *llcmap_t;
+
+llcmap_t llcmap_new(int socket, int node, int npages, int nlines, int pagesize, int ncores);
+void llcmap_free(llcmap_t m);
+
+void llcmap_write(FILE *f, llcmap_t m);
+llcmap_t llcmap_read(FILE *f, int pagesize);
+
+// Folds one set index's mean latency from core to slice into the map
+void llcmap_addlatency(llcmap_t m, int core, int slice, int latency);
+
+// Fits an XOR slice hash to the map, returns the num of lines it gets wrong or -1
+int llcmap_inferhash(llcmap_t m);
+
+// Sorts the pages by frame for llcmap_slice, again whenever frames change
+void llcmap_sortframes(llcmap_t m);
+
+// Slice of a physical address, from the buffer if it lies in it, else the hash
+// if the address differs from the buffer only in bits it was fitted on, else -1
+int llcmap_slice(llcmap_t m, uint64_t pa);
+
+#endif // __LLCMAP_H__
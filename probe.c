@@ -19,13 +19,19 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <math.h>
 #include <sys/mman.h>
 #include <sched.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/vfs.h>
+#include <sys/file.h>
+#include <pthread.h>
 
 
 #ifdef __APPLE__
@@ -36,6 +42,11 @@
 #include "pageset.h"
 #include "timestats.h"
 #include "sysinfo.h"
+#include "topology.h"
+#include "llcmap.h"
+#include "probe.h"
+#include "kernels.h"
+#include "sim.h"
 
 #ifdef VM_FLAGS_SUPERPAGE_SIZE_ANY
 #define MAP_LARGEPAGES	VM_FLAGS_SUPERPAGE_SIZE_ANY
@@ -77,7 +88,46 @@
 // Number of probes to find the set index of a virtual address
 #define SETINDEX_NPROBE	64
 
-#define MAX_SLICES 32
+// Samples per core in acctime, the simulator needs far fewer
+#define ACCTIME_COUNT		100000
+#define ACCTIME_SIMCOUNT	1000
+// Lines acctime evicts with, a slice needs one more
+#define ACCTIME_LINES		10
+// Above twice this many cores, all cores get a short screening run and only
+// the closest ones the full count
+#define ACCTIME_FINALISTS	4
+
+#define MASKWORDS	((MAX_CORES + 63) / 64)
+
+// Candidates split classifies together, at most half the associativity
+#define SPLIT_BATCH	8
+
+// Lines outside the buffer remembered per socket by probe_slices
+#define MEMO_SIZE	4096
+#define MEMO_PHYS	(1ULL << 63)
+
+// Chains shorter than this are not worth splitting with the helper
+#define HELPER_MINLEN	16
+// Spins before a waiting thread yields, in case the sibling is busy
+#define HELPER_SPINS	4096
+
+#ifndef MPOL_BIND
+#define MPOL_BIND	2
+#endif
+
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB	(30 << 26)
+#endif
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE	0x100000
+#endif
+
+#define PAGEMAP_PFN	((1ULL << 55) - 1)
+
+// File-backed and simulated buffers live at a fixed address
+#define EB_FIXEDBASE	0x600000000000ULL
+#define EB_STRIDE	(64ULL * GB)
 
 static int debug = 0;
 
@@ -100,27 +150,149 @@ typedef union setindex *setindex_t;
 
 typedef char setindexmap[SETINDEX_LINES];
 
+/*a virtual line and its slice*/
+struct memo {
+  uint64_t line;    /*line number + 1, 0 if empty, MEMO_PHYS set if physical*/
+  int slice;
+};
+
+/*a set of cores of one socket*/
+typedef struct { uint64_t w[MASKWORDS]; } coremask_t;
+
+/*
+ * A thread on the sibling hyperthread of a socket's first core that walks
+ * the second half of each eviction chain while the mapping thread walks the
+ * first.  One job at a time is handed over through posted and done.
+ */
+struct helper {
+  pthread_t thread;
+  int cpu;
+  cacheline_t chain;
+  int len;
+  int link;
+  int passes;
+  unsigned posted;  /*jobs handed over, written by the mapping thread*/
+  unsigned done;    /*jobs finished, written by the helper*/
+  int stop;         /*set to end the helper once it is idle*/
+};
+
+/*per-socket state, each socket maps its own LLC from its own buffer*/
+struct llc {
+  struct socketinfo *socket;
+  setindex_t eb;
+  llcmap_t map;
+  pageset_t todo;   /*set indices still to map*/
+  struct helper *helper;
+  struct memo *memo;  /*slices of lines outside the buffer, MEMO_SIZE entries*/
+  pthread_mutex_t lock; /*held by a probe_slices call measuring this LLC*/
+};
+
 static struct probeinfo {
   uint64_t ebsetindices;
-  setindex_t eb;
-} probeinfo;
+  int nways;
+  const char *backing;
+  struct simconfig sim;
+  int acccount;
+  int threshold;    /*cycles separating LLC hits from misses*/
+  struct evictpattern pattern;
+  int usehelper;
+  int nllcs;
+  struct llc llcs[MAX_SOCKETS];
+} probeinfo = {
+  .acccount = ACCTIME_COUNT,
+  .threshold = L3THRESHOLD,
+  .pattern = { EVICT_COUNT, 1, 1, 0 },
+};
 
-void probe_clflush(volatile void *p) {
+static void hw_clflush(volatile void *p) {
   asm __volatile__ ("clflush 0(%0)" : : "r" (p):);
 }
 
-void probe_access(volatile void *p) {
+static inline __attribute__((always_inline)) void hw_access(volatile void *p) {
   asm __volatile__ ("mov (%0), %%ebx" : : "r" (p) : "%ebx");
 }
 
-static void walk(cacheline_t cl, int ind) {
+static void hw_walk(cacheline_t cl, int ind) {
   while (cl != NULL) 
     cl = cl->cl_links[ind];
 }
 
+static int hw_time(volatile void *p) {
+  volatile int rv;
+  asm __volatile__ (
+      "xorl %%eax, %%eax\n"
+      "cpuid\n"
+      "rdtsc\n"
+      "mov %%eax, %%esi\n"
+      "mov (%%rdi), %%rdi\n"
+      "rdtscp\n"
+      "sub %%eax, %%esi\n"
+      "xorl %%eax, %%eax\n"
+      "cpuid\n"
+      "xorl %%eax, %%eax\n"
+      "subl %%esi, %%eax\n"
+      : "=a" (rv) : "D" (p) : "%rbx", "%rcx", "%rdx", "%rsi");
+  return rv;
+}
+
+static void hw_migrate(int cpu) {
+  cpu_set_t cs;
+  CPU_ZERO(&cs);
+  CPU_SET(cpu, &cs);
+  if (sched_setaffinity(0, sizeof(cs), &cs) < 0) {
+    perror("migrate");
+    exit(1);
+  }
+}
+
+static void sim_walk(cacheline_t cl, int ind) {
+  while (cl != NULL) {
+    sim_access(cl);
+    cl = cl->cl_links[ind];
+  }
+}
+
+/*where measurements go, the hardware or the simulated LLC*/
+struct backend {
+  void (*clflush)(volatile void *p);
+  void (*access)(volatile void *p);
+  int (*time)(volatile void *p);
+  void (*walk)(cacheline_t cl, int ind);
+  void (*migrate)(int cpu);
+};
+
+static const struct backend hwbackend = { hw_clflush, hw_access, hw_time, hw_walk, hw_migrate };
+static const struct backend simbackend = { sim_clflush, sim_access, sim_time, sim_walk, sim_setcore };
+static const struct backend *backend = &hwbackend;
+
+void probe_clflush(volatile void *p) {
+  backend->clflush(p);
+}
+
+void probe_access(volatile void *p) {
+  backend->access(p);
+}
+
+int probe_time(volatile void *p) {
+  return backend->time(p);
+}
+
+static void walk(cacheline_t cl, int ind) {
+  backend->walk(cl, ind);
+}
+
+static void migrate(int cpu) {
+  backend->migrate(cpu);
+}
+
+
+static struct llc *localllc() {
+  int s = topo_cpusocket(sched_getcpu());
+  return &probeinfo.llcs[s < 0 ? 0 : s];
+}
 
 void probe_evict(int si) {
-  walk (&probeinfo.eb[0].cachelines[si], 0);
+  walk (&localllc()->eb[0].cachelines[si], 0);
 }
 
 int probe_npages() {
@@ -132,11 +304,15 @@ int probe_noffsets() {
 }
 
 int probe_nways() {
-  return NWAYS;
+  return probeinfo.nways;
 }
 
 int probe_ncores() {
-  return NCORES;
+  return localllc()->socket->ncores;
+}
+
+int probe_nsockets() {
+  return probeinfo.nllcs;
 }
 
 int probe_pagesize() {
@@ -145,22 +321,44 @@ int probe_pagesize() {
 
 
 
-int probe_time(volatile void *p) {
-  volatile int rv;
-  asm __volatile__ (
-      "xorl %%eax, %%eax\n"
-      "cpuid\n"
-      "rdtsc\n"
-      "mov %%eax, %%esi\n"
-      "mov (%%rdi), %%rdi\n"
-      "rdtscp\n"
-      "sub %%eax, %%esi\n"
-      "xorl %%eax, %%eax\n"
-      "cpuid\n"
-      "xorl %%eax, %%eax\n"
-      "subl %%esi, %%eax\n"
-      : "=a" (rv) : "D" (p) : "%rbx", "%rcx", "%rdx", "%rsi");
-  return rv;
+static void evict_generic(cacheline_t cl, int len, int link, int passes) {
+  for (int j = 0; j < passes; j++)
+    walk(cl, link);
+}
+
+static void measure_generic(cacheline_t cc, cacheline_t cl, int len, int link, int passes, ts_t ts, int count) {
+  for (int i = 0; i < count; i++) {
+    probe_access(cc);
+    for (int j = 0; j < passes; j++)
+      walk(cl, link);
+    ts_add(ts, probe_time(cc));
+  }
+}
+
+KERNEL_SIZES(DEFINE_KERNEL)
+DEFINE_CHUNKED_KERNEL
+
+struct kernel {
+  int len;
+  void (*evict)(cacheline_t cl, int len, int link, int passes);
+  void (*measure)(cacheline_t cc, cacheline_t cl, int len, int link, int passes, ts_t ts, int count);
+};
+
+static const struct kernel kernels[] = {
+  KERNEL_SIZES(KERNEL_ENTRY)
+};
+
+static const struct kernel generic = { 0, evict_generic, measure_generic };
+static const struct kernel chunked = { 0, evict_chunked, measure_chunked };
+
+// Kernel unrolled for an eviction set of len lines, else in blocks, or the generic loop for the simulator
+static const struct kernel *kernelfor(int len) {
+  if (backend != &hwbackend)
+    return &generic;
+  for (int i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++)
+    if (kernels[i].len == len)
+      return &kernels[i];
+  return &chunked;
 }
 
 int probe_setindex(void *p) {
@@ -196,137 +394,347 @@ static pageset_t ebpageset() {
   return rv;
 }
 
-void evictmeasureloop(pageset_t ps, int candidate, int si, int link, ts_t ts, int count) {
-  ts_clear(ts);
-  void *cc = &probeinfo.eb[candidate].cachelines[si];
-  cacheline_t cl = NULL;
-  for (int i = ps_size(ps); i--; ) {
-    int n = ps_get(ps, i);
-    probeinfo.eb[n].cachelines[si].cl_links[link] = cl;
-    cl = &probeinfo.eb[n].cachelines[si];
+// Slides a window over the lines, accessing it repeat times at each step
+#define PATTERNWALK(name, access)						\
+static void name(cacheline_t *lines, int n, const struct evictpattern *pat) {	\
+  for (int p = 0; p < pat->passes; p++) {					\
+    int back = pat->zigzag && (p & 1);						\
+    for (int i = 0; i + pat->window <= n; i++)					\
+      for (int r = 0; r < pat->repeat; r++)					\
+	for (int d = 0; d < pat->window; d++)					\
+	  access(lines[back ? n - 1 - i - d : i + d]);				\
+  }										\
+}
+
+// On hardware the loads are inlined, not a call through the backend per line
+PATTERNWALK(hwpatternwalk, hw_access)
+PATTERNWALK(backendpatternwalk, probe_access)
+
+static void patternwalk(cacheline_t *lines, int n, const struct evictpattern *pat) {
+  if (backend == &hwbackend)
+    hwpatternwalk(lines, n, pat);
+  else
+    backendpatternwalk(lines, n, pat);
+}
+
+static int plainpattern(const struct evictpattern *pat) {
+  return pat->window == 1 && pat->repeat == 1 && !pat->zigzag;
+}
+
+static void spin(int n) {
+  if (n % HELPER_SPINS == 0)
+    sched_yield();
+  else
+    asm __volatile__ ("pause");
+}
+
+static void *helpertask(void *arg) {
+  struct helper *h = arg;
+  if (backend == &hwbackend)
+    migrate(h->cpu);
+  unsigned seen = 0;
+  for (;;) {
+    for (int n = 1; __atomic_load_n(&h->posted, __ATOMIC_ACQUIRE) == seen; n++) {
+      if (__atomic_load_n(&h->stop, __ATOMIC_ACQUIRE))
+	return NULL;
+      spin(n);
+    }
+    seen++;
+    kernelfor(h->len)->evict(h->chain, h->len, h->link, h->passes);
+    __atomic_store_n(&h->done, seen, __ATOMIC_RELEASE);
+  }
+  return NULL;
+}
+
+static void helperpost(struct helper *h, cacheline_t chain, int len, int link, int passes) {
+  h->chain = chain;
+  h->len = len;
+  h->link = link;
+  h->passes = passes;
+  __atomic_store_n(&h->posted, h->posted + 1, __ATOMIC_RELEASE);
+}
+
+static void helperwait(struct helper *h) {
+  for (int n = 1; __atomic_load_n(&h->done, __ATOMIC_ACQUIRE) != h->posted; n++)
+    spin(n);
+}
+
+/*
+ * The helper only runs while a task measures its socket, so it does not
+ * spin on the sibling between calls.
+ */
+static void starthelper(struct llc *llc) {
+  int cpu = llc->socket->siblings[0];
+  if (!probeinfo.usehelper || llc->helper != NULL || (backend == &hwbackend && cpu < 0))
+    return;
+  llc->helper = calloc(1, sizeof(struct helper));
+  llc->helper->cpu = cpu;
+  if (pthread_create(&llc->helper->thread, NULL, helpertask, llc->helper) != 0) {
+    perror("starthelper: pthread_create");
+    exit(1);
   }
+}
+
+static void stophelper(struct llc *llc) {
+  struct helper *h = llc->helper;
+  if (h == NULL)
+    return;
+  __atomic_store_n(&h->stop, 1, __ATOMIC_RELEASE);
+  pthread_join(h->thread, NULL);
+  free(h);
+  llc->helper = NULL;
+}
+
+// Both hyperthreads walk their half of the chain between access and time
+static void helpedmeasure(struct llc *llc, cacheline_t cc, cacheline_t head, int hlen, cacheline_t tail, int tlen,
+    int link, int passes, ts_t ts, int count) {
+  struct helper *h = llc->helper;
+  const struct kernel *k = kernelfor(hlen);
   for (int i = 0; i < count; i++) {
     probe_access(cc);
-    for (int j = 0; j < EVICT_COUNT; j++)
-      walk(cl, link);
+    helperpost(h, tail, tlen, link, passes);
+    k->evict(head, hlen, link, passes);
+    helperwait(h);
     ts_add(ts, probe_time(cc));
   }
 }
 
-int probe_evictMeasure(pageset_t evict, int measure, int offset, ts_t ts, int count) {
-  evictmeasureloop(evict, measure, offset, 1, ts, count);
+// Times cc, any line at set index si, after evicting with the lines of ps
+static void evictmeasureat(struct llc *llc, pageset_t ps, void *cc, int si, int link, ts_t ts, int count) {
+  ts_clear(ts);
+  const struct evictpattern *pat = &probeinfo.pattern;
+  if (!plainpattern(pat)) {
+    int n = ps_size(ps);
+    cacheline_t lines[n + 1];
+    for (int i = 0; i < n; i++)
+      lines[i] = &llc->eb[ps_get(ps, i)].cachelines[si];
+    for (int i = 0; i < count; i++) {
+      probe_access(cc);
+      patternwalk(lines, n, pat);
+      ts_add(ts, probe_time(cc));
+    }
+    return;
+  }
+  int n = ps_size(ps);
+  int half = llc->helper != NULL && n >= HELPER_MINLEN ? n / 2 : n;
+  cacheline_t cl = NULL, tail = NULL;
+  for (int i = n; i--; ) {
+    if (i == half - 1) {
+      tail = cl;
+      cl = NULL;
+    }
+    int p = ps_get(ps, i);
+    llc->eb[p].cachelines[si].cl_links[link] = cl;
+    cl = &llc->eb[p].cachelines[si];
+  }
+  if (tail != NULL)
+    helpedmeasure(llc, cc, cl, half, tail, n - half, link, pat->passes, ts, count);
+  else
+    kernelfor(n)->measure(cc, cl, n, link, pat->passes, ts, count);
+}
+
+void evictmeasureloop(struct llc *llc, pageset_t ps, int candidate, int si, int link, ts_t ts, int count) {
+  evictmeasureat(llc, ps, &llc->eb[candidate].cachelines[si], si, link, ts, count);
+}
+
+int probe_evictMeasure(struct llc *llc, pageset_t evict, int measure, int offset, ts_t ts, int count) {
+  evictmeasureloop(llc, evict, measure, offset, 1, ts, count);
   return ts_median(ts);
 }
 
-static void findmap(pageset_t eb, int candidate, char *map, pageset_t *pss, int si, ts_t ts) {
+// Slice groups split may find, with room for spurious ones
+static int maxgroups(struct llc *llc) {
+  return 2 * llc->socket->ncores;
+}
+
+static int newgroup(pageset_t *pss, int ngroups) {
+  for (int j = 0; j < ngroups; j++)
+    if (pss[j] == NULL) {
+      pss[j] = ps_new();
+      return j;
+    }
+  return -1;
+}
+
+/*
+ * eb evicts the candidate and holds at most nways lines of any slice, so
+ * leaving out any one line of the candidate's slice stops the eviction.
+ * One line of each group already found tells if the candidate is in it,
+ * after that only the unmapped lines of eb need testing.
+ */
+static void findmap(struct llc *llc, pageset_t eb, int candidate, char *map, pageset_t *pss, int si, ts_t ts) {
+  int ngroups = maxgroups(llc);
   pageset_t t = ps_dup(eb);
-  pageset_t quick[MAX_SLICES];
-  for (int i = 0; i < MAX_SLICES; i++)
-    quick[i] = NULL;
+  char tried[ngroups];
+  memset(tried, 0, ngroups);
   int psid = -1;
   int new = 0;
-  for (int i = 0; i < ps_size(eb); i++)  {
-    int r = ps_get(eb, i);
-    ps_remove(t, r);
-    if (probe_evictMeasure(t, candidate, si, ts, 32) < L3THRESHOLD) {
-      if (map[r] == -1) {
-	if (psid == -1) {
-	  for (int j = 0; j < MAX_SLICES; j++) 
-	    if (pss[j] == NULL) {
-	      pss[j] = ps_new();
-	      psid = j;
-	      break;
+  for (int pass = 0; pass < 2; pass++) {
+    for (int i = 0; i < ps_size(eb); i++)  {
+      int r = ps_get(eb, i);
+      if (pass == 0 && (psid != -1 || map[r] == -1 || tried[map[r]]))
+	continue;
+      if (pass == 1 && map[r] != -1)
+	continue;
+      if (pass == 0)
+	tried[map[r]] = 1;
+      ps_remove(t, r);
+      if (probe_evictMeasure(llc, t, candidate, si, ts, 32) < probeinfo.threshold) {
+	if (map[r] == -1) {
+	  if (psid == -1) {
+	    psid = newgroup(pss, ngroups);
+	    if (psid == -1) {
+	      fprintf(stderr, "Socket %d set 0x%03x: more than %d slices\n", llc->socket->id, si, ngroups);
+	      ps_push(t, r);
+	      goto done;
 	    }
-	  new = 1;
+	    new = 1;
+	  }
+	  if (debug) {
+	    if (!new)
+	      fprintf(stderr, "Unmapped eb %d added to set %d\n", r, psid);
+	    else
+	      fprintf(stderr, "(eb) %d ==> %d\n", r, psid);
+	  }
+	  map[r] = psid;
+	  ps_push(pss[psid], r);
 	}
-	if (debug) {
-	  if (!new)
-	    fprintf(stderr, "Unmapped eb %d added to set %d\n", r, psid);
-	  else
-	    fprintf(stderr, "(eb) %d ==> %d\n", r, psid);
+	if (psid == -1) 
+	  psid = map[r];
+	if (psid != map[r])
+	  fprintf(stderr, "Double conflict %d, %d (on eb %d)\n", psid, map[r], r);
+	if (map[candidate] == -1)  {
+	  //fprintf(stderr, "(ca) %d ==> %d\n", candidate, psid);
+	  map[candidate] = psid;
+	  ps_push(pss[psid], candidate);
 	}
-	map[r] = psid;
-	ps_push(pss[psid], r);
-      }
-      if (psid == -1) 
-	psid = map[r];
-      if (psid != map[r])
-	fprintf(stderr, "Double conflict %d, %d (on eb %d)\n", psid, map[r], r);
-      if (map[candidate] == -1)  {
-	//fprintf(stderr, "(ca) %d ==> %d\n", candidate, psid);
-	map[candidate] = psid;
-	ps_push(pss[psid], candidate);
       }
+      ps_push(t, r);
     }
-    ps_push(t, r);
   }
+done:
+  ps_delete(t);
 }
   
 
-static int findquick(pageset_t *quick, int candidate, pageset_t *pss,  char *map, int si, ts_t ts, int count) {
-  for (int i = 0; i < MAX_SLICES; i++) {
-    if (quick[i] != NULL && probe_evictMeasure(quick[i], candidate, si, ts, count) >= L3THRESHOLD) {
-      int index = ps_get(quick[i], 0);
-      map[candidate] = map[index];
-      ps_push(pss[map[index]], candidate);
-      return 1;
+/*
+ * Primes n candidates, evicts once with ps and then times each of them, so
+ * one walk serves the whole batch.  The other candidates add to the
+ * pressure on their slices, at most n - 1 lines each.
+ */
+static void batchmeasure(struct llc *llc, pageset_t ps, const int *cands, int n, int si, ts_t *ts, int count) {
+  const struct evictpattern *pat = &probeinfo.pattern;
+  int len = ps_size(ps);
+  cacheline_t lines[len + 1];
+  cacheline_t cl = NULL;
+  for (int i = len; i--; ) {
+    lines[i] = &llc->eb[ps_get(ps, i)].cachelines[si];
+    lines[i]->cl_links[1] = cl;
+    cl = lines[i];
+  }
+  const struct kernel *k = kernelfor(len);
+  cacheline_t cc[n];
+  for (int j = 0; j < n; j++) {
+    cc[j] = &llc->eb[cands[j]].cachelines[si];
+    ts_clear(ts[j]);
+  }
+  for (int i = 0; i < count; i++) {
+    for (int j = 0; j < n; j++)
+      probe_access(cc[j]);
+    if (plainpattern(pat))
+      k->evict(cl, len, 1, pat->passes);
+    else
+      patternwalk(lines, len, pat);
+    for (int j = 0; j < n; j++)
+      ts_add(ts[j], probe_time(cc[j]));
+  }
+}
+
+/*
+ * Files the candidates a quick set evicts in its group, returns the others.
+ * Under policies that age every line on a miss the rest of the batch can
+ * push a candidate out, so each hit is confirmed alone.
+ */
+static int findquick(struct llc *llc, pageset_t *quick, int *cands, int n, pageset_t *pss,  char *map, int si, ts_t *ts, int count) {
+  for (int i = 0; n > 0 && i < maxgroups(llc) && quick[i] != NULL; i++) {
+    batchmeasure(llc, quick[i], cands, n, si, ts, count);
+    int index = ps_get(quick[i], 0);
+    int left = 0;
+    for (int j = 0; j < n; j++) {
+      if (ts_median(ts[j]) >= probeinfo.threshold &&
+	  probe_evictMeasure(llc, quick[i], cands[j], si, ts[j], count) >= probeinfo.threshold) {
+	map[cands[j]] = map[index];
+	ps_push(pss[map[index]], cands[j]);
+      } else
+	cands[left++] = cands[j];
     }
+    n = left;
   }
-  return 0;
+  return n;
 }
 
 
-pageset_t *split(int si) {
+/*
+ * Groups the buffer's lines at set index si by slice, maxgroups(llc)
+ * entries.  Candidates go through the quick sets SPLIT_BATCH at a time,
+ * those left over are tested against eb alone since every push changes it.
+ */
+pageset_t *split(struct llc *llc, int si) {
+  int ngroups = maxgroups(llc);
   pageset_t candidates = ebpageset();
   pageset_t eb = ps_new();
-  cacheline_t ebcl = NULL;
-  pageset_t *rv = calloc(MAX_SLICES, sizeof(pageset_t));
-  pageset_t quick[MAX_SLICES];
-  for (int i = 0; i < MAX_SLICES; i++)
-    quick[i] = NULL;
+  pageset_t *rv = calloc(ngroups, sizeof(pageset_t));
+  pageset_t *quick = calloc(ngroups, sizeof(pageset_t));
+  int nquick = 0;
   char *map = malloc(probeinfo.ebsetindices);
   for (int i = 0; i < probeinfo.ebsetindices; i++)
     map[i] = -1;
 
-  ts_t ts = ts_alloc();
-  int i = 0;
-  int fq = 0;
+  int batch = probeinfo.nways / 2 < SPLIT_BATCH ? probeinfo.nways / 2 : SPLIT_BATCH;
+  if (batch < 1)
+    batch = 1;
+  ts_t ts[batch];
+  for (int j = 0; j < batch; j++)
+    ts[j] = ts_alloc();
   while (ps_size(candidates)) {
-    int candidate = ps_pop(candidates);
-    if (findquick(quick, candidate, rv, map, si, ts, 32)) {
-      fq++;
-      continue;
-    }
-    int time = probe_evictMeasure(eb, candidate, si, ts, 32);
-    //printf("%3d: %3d %d\n", i++, candidate, time);
-    if (time < L3THRESHOLD) 
-      ps_push(eb, candidate);
-    else {
-      findmap(eb, candidate, map, rv, si, ts);
-      if (map[candidate] != -1 && ps_size(rv[map[candidate]]) ==25) {
-	for (int i = 0; i < MAX_SLICES; i++)
-	  if (quick[i] == NULL) {
-	    quick[i] = ps_dup(rv[map[candidate]]);
-	    break;
-	  }
+    int cands[batch];
+    int n = 0;
+    while (n < batch && ps_size(candidates))
+      cands[n++] = ps_pop(candidates);
+    n = findquick(llc, quick, cands, n, rv, map, si, ts, 32);
+    for (int j = 0; j < n; j++) {
+      int candidate = cands[j];
+      int time = probe_evictMeasure(llc, eb, candidate, si, ts[0], 32);
+      if (time < probeinfo.threshold) 
+	ps_push(eb, candidate);
+      else {
+	findmap(llc, eb, candidate, map, rv, si, ts[0]);
+	if (map[candidate] != -1 && ps_size(rv[map[candidate]]) == probeinfo.nways + 5 && nquick < ngroups)
+	  quick[nquick++] = ps_dup(rv[map[candidate]]);
       }
     }
   }
-  for (int i = 0; i < MAX_SLICES; i++) {
-    if (quick[i] != NULL)
-      ps_delete(quick[i]);
-  }
+  for (int i = 0; i < nquick; i++)
+    ps_delete(quick[i]);
+  free(quick);
+  ps_delete(candidates);
+  ps_delete(eb);
+  for (int j = 0; j < batch; j++)
+    ts_free(ts[j]);
   free(map);
   return rv;
 }
 
-int acctime(ts_t ts, pageset_t ps, int si, int link, int count) {
+// Times the (ACCTIME_LINES + 1)'th line of ps, -1 if ps is shorter
+int acctime(struct llc *llc, ts_t ts, pageset_t ps, int si, int link, int count) {
   ts_clear(ts);
+  if (ps_size(ps) <= ACCTIME_LINES)
+    return -1;
   pageset_t tps = ps_new();
-  for (int i = 0; i < 10; i++)
+  for (int i = 0; i < ACCTIME_LINES; i++)
     ps_push(tps, ps_get(ps, i));
-  int cand = ps_get(ps, 10);
-  evictmeasureloop(tps, cand, si, link, ts, count);
+  int cand = ps_get(ps, ACCTIME_LINES);
+  evictmeasureloop(llc, tps, cand, si, link, ts, count);
   int rv = ts_median(ts);
   ps_delete(tps);
   return rv;
@@ -334,163 +742,794 @@ int acctime(ts_t ts, pageset_t ps, int si, int link, int count) {
 
 static int timeplot = 0;
 
-char *probe_map1(int setindex) {
+static void maskset(coremask_t *m, int c) {
+  m->w[c / 64] |= 1ULL << c % 64;
+}
+
+static void maskclear(coremask_t *m, int c) {
+  m->w[c / 64] &= ~(1ULL << c % 64);
+}
+
+static int maskhas(const coremask_t *m, int c) {
+  return m->w[c / 64] >> c % 64 & 1;
+}
+
+static int maskcount(const coremask_t *m) {
+  int rv = 0;
+  for (int i = 0; i < MASKWORDS; i++)
+    rv += __builtin_popcountll(m->w[i]);
+  return rv;
+}
+
+// Lowest core in m, -1 if none
+static int maskfirst(const coremask_t *m) {
+  for (int i = 0; i < MASKWORDS; i++)
+    if (m->w[i])
+      return i * 64 + __builtin_ctzll(m->w[i]);
+  return -1;
+}
+
+static void maskprint(FILE *f, const coremask_t *m) {
+  int i = MASKWORDS - 1;
+  while (i > 0 && m->w[i] == 0)
+    i--;
+  fprintf(f, " 0x%02llx", (unsigned long long)m->w[i]);
+  while (i--)
+    fprintf(f, "%016llx", (unsigned long long)m->w[i]);
+}
+
+// Mean time, in tenths of a cycle, to reach the lines of ps from core
+static int coretime(struct llc *llc, ts_t ts, pageset_t ps, int si, int core, int count) {
+  migrate(llc->socket->cpus[core]);
+  acctime(llc, ts, ps, si, 1, count);
+  return ts_mean(ts, 10);
+}
+
+char *probe_map1(struct llc *llc, int setindex) {
+  int ncores = llc->socket->ncores;
+  // coretime leaves the thread on the last core timed, split runs beside the helper
+  migrate(llc->socket->cpus[0]);
   char name[1000];
-  sprintf(name, "Map/Index-%03x.plot", setindex);
+  sprintf(name, "Map/Socket-%d-Index-%03x.plot", llc->socket->id, setindex);
   FILE *f = fopen(name, "w");
   if (f) 
-    fprintf(f, "set term pdfcairo size 11.7,8.27\nset xrange [0:%d]\nset style fill solid noborder\nset yrange [0:50000]\nset multiplot layout %d,%d title 'Set index 0x%03x'\n", L3THRESHOLD, NCORES, NCORES, setindex);
+    fprintf(f, "set term pdfcairo size 11.7,8.27\nset xrange [0:%d]\nset style fill solid noborder\nset yrange [0:50000]\nset multiplot layout %d,%d title 'Socket %d set index 0x%03x'\n", probeinfo.threshold, ncores, ncores, llc->socket->id, setindex);
   char *rv = malloc(probeinfo.ebsetindices);
   for (int i = 0; i < probeinfo.ebsetindices; i++)
     rv[i] = -1;
   ts_t ts = ts_alloc();
-  fprintf(stderr, "Set 0x%03x Times: ", setindex);
-  pageset_t *map = split(setindex);
-  char cores[NCORES];
-  for (int i = 0; i < NCORES;i++)
-    cores[i] = 0;
-  for (int slice = 0; slice < NCORES; slice++) {
+  fprintf(stderr, "Socket %d set 0x%03x Times: ", llc->socket->id, setindex);
+  pageset_t *map = split(llc, setindex);
+  coremask_t cores[ncores];
+  int means[ncores][ncores];
+  memset(cores, 0, sizeof(cores));
+  for (int slice = 0; slice < ncores; slice++) {
+    if (map[slice] != NULL && ps_size(map[slice]) <= ACCTIME_LINES) {
+      fprintf(stderr, "Error socket %d set 0x%03x: Slice %d has only %d lines\n", llc->socket->id, setindex, slice, ps_size(map[slice]));
+      ps_delete(map[slice]);
+      map[slice] = NULL;
+    }
     if (map[slice] != NULL) {
       ps_sort(map[slice]);
+      int order[ncores];
+      int nfinal = ncores;
+      for (int core = 0; core < ncores; core++)
+	order[core] = core;
+      if (ncores > 2 * ACCTIME_FINALISTS) {
+	// Screening costs as much as the final runs, whatever the core count
+	for (int core = 0; core < ncores; core++)
+	  means[slice][core] = coretime(llc, ts, map[slice], setindex, core, probeinfo.acccount * ACCTIME_FINALISTS / ncores);
+	nfinal = ACCTIME_FINALISTS;
+	for (int a = 0; a < nfinal; a++)
+	  for (int b = a + 1; b < ncores; b++)
+	    if (means[slice][order[b]] < means[slice][order[a]]) {
+	      int t = order[a];
+	      order[a] = order[b];
+	      order[b] = t;
+	    }
+      }
       int mincore = -1;
       int mincoretime = 100000;
-      for (int core = 0; core < NCORES; core++) {
-	cpu_set_t cs;
-	CPU_ZERO(&cs);
-	CPU_SET(COREID(core), &cs);
-	if (sched_setaffinity(0, sizeof(cs), &cs) < 0) {
-	  perror("migrate");
-	  exit(1);
-	}
-	acctime(ts, map[slice], setindex, 1, 100000);
+      for (int k = 0; k < nfinal; k++) {
+	int core = order[k];
+	int mean = coretime(llc, ts, map[slice], setindex, core, probeinfo.acccount);
 	if (f != NULL) {
 	  fprintf(f, "set title 'Slice %d, Core %d'\nunset key\nplot '-' using 1:2 with boxes notitle\n", slice, core);
-	  for (int i = 1; i < L3THRESHOLD; i++)
+	  for (int i = 1; i < probeinfo.threshold; i++)
 	    fprintf(f, "%d %d\n", i, ts_get(ts, i));
 	  fprintf(f, "e\n");
 	}
-	int mean = ts_mean(ts, 10);
+	means[slice][core] = mean;
 	if (mean < mincoretime) {
 	  mincoretime = mean;
 	  mincore = core;
 	}
-	fprintf(stderr, "%2d.%01d ", mean/10, mean %10);
-
-	/*if (ts_get(ts, 39) > 45000 && ts_get(ts,46) > 40000 && ts_get(ts, 39) + ts_get(ts,46) > 95000) {
-	  cores[slice] |= 1<<core;
-	} */
       }
+      for (int core = 0; core < ncores; core++)
+	fprintf(stderr, "%2d.%01d ", means[slice][core]/10, means[slice][core] %10);
       fprintf(stderr, "/ ");
-      cores[slice] = 1 << mincore;
+      maskset(&cores[slice], mincore);
     }
   }
-  fprintf(stderr, "\nBefore cleaning set 0x%03x:", setindex);
-  for (int i = 0; i < NCORES;i++)
-    fprintf(stderr, " 0x%02x", cores[i]);
+  fprintf(stderr, "\nBefore cleaning socket %d set 0x%03x:", llc->socket->id, setindex);
+  for (int i = 0; i < ncores;i++)
+    maskprint(stderr, &cores[i]);
   fprintf(stderr, "\n");
-  char c1[NCORES];
-  for (int i = 0; i < NCORES;i++)
+  int c1[ncores];
+  for (int i = 0; i < ncores;i++)
     c1[i] = -1;
   int mod;
   do {
     mod = 0;
-    for (int i = 0; i < NCORES; i++) {
-      if (cores[i] == 0  || (cores[i] & (cores[i] - 1)))
+    for (int i = 0; i < ncores; i++) {
+      if (maskcount(&cores[i]) != 1)
 	continue;
-      for (int j = 0; j < NCORES; j++) {
-	if (j == i)
-	  continue;
-	if (cores[j] != cores[i] && ((cores[j] & cores[i]) != 0 )) {
-	  cores[j] &= ~cores[i];
+      int core = maskfirst(&cores[i]);
+      for (int j = 0; j < ncores; j++) {
+	if (j != i && maskcount(&cores[j]) > 1 && maskhas(&cores[j], core)) {
+	  maskclear(&cores[j], core);
 	  mod =1;
 	}
       }
     }
   } while (mod);
-  fprintf(stderr, "After cleaning set 0x%03x:", setindex);
-  for (int i = 0; i < NCORES;i++)
-    fprintf(stderr, " 0x%02x", cores[i]);
+  fprintf(stderr, "After cleaning socket %d set 0x%03x:", llc->socket->id, setindex);
+  for (int i = 0; i < ncores;i++)
+    maskprint(stderr, &cores[i]);
   fprintf(stderr, "\n");
-  for (int i = 0; i < NCORES; i++) {
+  for (int i = 0; i < ncores; i++) {
     mod = -1;
-    for (int j = 0; j < NCORES; j++) {
-      if (cores[j] == 1<<i) {
+    for (int j = 0; j < ncores; j++) {
+      if (maskcount(&cores[j]) == 1 && maskhas(&cores[j], i)) {
 	c1[j] = i;
 	if (mod != -1)
-	  fprintf(stderr, "Error set 0x%03x: Slices %d and %d map to core %d\n", setindex, j, mod, i);
+	  fprintf(stderr, "Error socket %d set 0x%03x: Slices %d and %d map to core %d\n", llc->socket->id, setindex, j, mod, i);
 	mod = j;
       }
     }
     if (mod == -1)
-      fprintf(stderr, "Error set 0x%03x: No slice maps to core %d\n", setindex, i);
+      fprintf(stderr, "Error socket %d set 0x%03x: No slice maps to core %d\n", llc->socket->id, setindex, i);
   }
 
-  for (int slice = 0; slice < NCORES; slice++) {
+  for (int slice = 0; slice < ncores; slice++) {
     if (map[slice] != NULL)  {
       for (int i = 0; i < ps_size(map[slice]); i++)
 	rv[ps_get(map[slice], i)] = c1[slice];
+      for (int core = 0; core < ncores; core++)
+	llcmap_addlatency(llc->map, core, c1[slice], means[slice][core]);
       ps_delete(map[slice]);
     } else {
-      fprintf(stderr, "Error set 0x%03x: Null slice\n", setindex);
+      fprintf(stderr, "Error socket %d set 0x%03x: Null slice\n", llc->socket->id, setindex);
     }
   }
+  for (int slice = ncores; slice < maxgroups(llc); slice++)
+    if (map[slice] != NULL) {
+      fprintf(stderr, "Error socket %d set 0x%03x: Extra slice %d\n", llc->socket->id, setindex, slice);
+      ps_delete(map[slice]);
+    }
+  free(map);
   if (f)
     fclose(f);
   ts_free(ts);
   return rv;
 }
-  
-char **probe_map() {
-  char **rv = calloc(SETINDEX_LINES, sizeof(char *));
-  for (int i = 0; i < SETINDEX_LINES; i++) {
-    rv[i] = probe_map1(i);
+
+// Runs task on each of nllcs args, size bytes apart, each in its own thread
+static void runthreads(void *(*task)(void *), void *args, size_t size) {
+  pthread_t threads[MAX_SOCKETS];
+  for (int s = 0; s < probeinfo.nllcs; s++) {
+    if (pthread_create(&threads[s], NULL, task, (char *)args + s * size) != 0) {
+      perror("runthreads: pthread_create");
+      exit(1);
+    }
   }
-  return rv;
+  for (int s = 0; s < probeinfo.nllcs; s++)
+    pthread_join(threads[s], NULL);
 }
 
+static void foreachllc(void *(*task)(void *)) {
+  runthreads(task, probeinfo.llcs, sizeof(struct llc));
+}
 
-void probe_init(uint64_t ebsetindices) {
+static void mapqueued(struct llc *llc) {
+  while (ps_size(llc->todo)) {
+    int i = ps_pop(llc->todo);
+    free(llc->map->slices[i]);
+    llc->map->slices[i] = probe_map1(llc, i);
+  }
+}
 
-  probeinfo.ebsetindices = ebsetindices  / SETINDEX_SIZE;
-  probeinfo.eb = (setindex_t) mmap64(NULL, probeinfo.ebsetindices * SETINDEX_SIZE, PROT_READ|PROT_WRITE, 
+static void *maptask(void *arg) {
+  struct llc *llc = arg;
+  migrate(llc->socket->cpus[0]);
+  starthelper(llc);
+  mapqueued(llc);
+  stophelper(llc);
+  return NULL;
+}
+
+// Maps the unmapped set indices from first to last of every socket
+void probe_map(int first, int last) {
+  if (first < 0)
+    first = 0;
+  if (last >= SETINDEX_LINES)
+    last = SETINDEX_LINES - 1;
+  for (int s = 0; s < probeinfo.nllcs; s++) {
+    struct llc *llc = &probeinfo.llcs[s];
+    for (int i = last; i >= first; i--)
+      if (llc->map->slices[i] == NULL)
+	ps_push(llc->todo, i);
+  }
+  foreachllc(maptask);
+}
+
+static void bindnode(void *p, uint64_t size, int node) {
+  if (node < 0 || node >= 64)
+    return;
+  unsigned long mask[2] = { 1UL << node, 0 };
+  if (syscall(SYS_mbind, p, size, MPOL_BIND, mask, 65, 0) < 0)
+    perror("probe_init: mbind");
+}
+
+// Anonymous buffer, on 1GB pages when the size allows and some are reserved
+static void ebanon(struct llc *llc, uint64_t size) {
+  llc->eb = MAP_FAILED;
+  if (size % HUGEPAGESIZE == 0)
+    llc->eb = (setindex_t) mmap64(NULL, size, PROT_READ|PROT_WRITE,
+						MAP_LARGEPAGES|MAP_HUGE_1GB|MAP_ANON|MAP_PRIVATE, -1, 0);
+  if (llc->eb == MAP_FAILED) {
+    if (debug)
+      fprintf(stderr, "probe_init: no 1GB pages, using default large pages\n");
+    llc->eb = (setindex_t) mmap64(NULL, size, PROT_READ|PROT_WRITE, 
       						MAP_LARGEPAGES|MAP_ANON|MAP_PRIVATE, -1, 0);
-  if (probeinfo.eb == MAP_FAILED) {
+  }
+  if (llc->eb == MAP_FAILED) {
     perror("probe_init: eb: mmap");
     exit(1);
   }
+  bindnode(llc->eb, size, llc->socket->node);
+}
 
-  int f = open("/proc/self/pagemap", O_RDONLY);
-  uint64_t buf;
-  uint64_t adrs = (uint64_t)probeinfo.eb;
-  for (uint64_t p = 0; p < ebsetindices; p += HUGEPAGESIZE) {
-    *((int *)(adrs + p)) = 1;
-    uint64_t seek = (adrs + p) /4096 * 8;
-    lseek64(f, seek, SEEK_SET);
-    int r = read(f, &buf, sizeof(buf));
-    printf("%d 0x%016llx\n", p/HUGEPAGESIZE, buf * 0x1000);
+/*
+ * Buffer backed by <backing>-<socket> on a hugetlbfs mount.  The file keeps
+ * its physical frames, and so its map, between runs.  Every measurement
+ * relinks chains inside the shared lines, so only one process may use the
+ * file at a time: it is locked for the life of the process and refused if
+ * another holds it.  Returns 1 if the file already holds a linked buffer
+ * of exactly this size.
+ */
+static int ebfile(struct llc *llc, uint64_t size) {
+  char name[1000];
+  sprintf(name, "%s-%d", probeinfo.backing, llc->socket->id);
+  int fd = open(name, O_RDWR|O_CREAT, 0666);
+  if (fd < 0) {
+    perror(name);
+    exit(1);
+  }
+  // kept open, the lock goes with it
+  if (flock(fd, LOCK_EX|LOCK_NB) < 0) {
+    fprintf(stderr, "%s: in use by another process, concurrent mapping is not supported\n", name);
+    exit(1);
   }
-  close(f);
-    
+  struct statfs sfs;
+  if (fstatfs(fd, &sfs) == 0 && sfs.f_bsize != HUGEPAGESIZE)
+    fprintf(stderr, "%s: page size is %ld, not %d\n", name, (long)sfs.f_bsize, HUGEPAGESIZE);
+  struct stat st;
+  if (fstat(fd, &st) < 0) {
+    perror(name);
+    exit(1);
+  }
+  int fresh = st.st_size == 0;
+  if (fresh && ftruncate(fd, (size + HUGEPAGESIZE - 1) / HUGEPAGESIZE * HUGEPAGESIZE) < 0) {
+    perror(name);
+    exit(1);
+  }
+  if (!fresh && st.st_size < size) {
+    fprintf(stderr, "%s: holds %lld bytes, need %lld\n", name, (long long)st.st_size, (long long)size);
+    exit(1);
+  }
+  void *base = (void *)(EB_FIXEDBASE + llc->socket->id * EB_STRIDE);
+  llc->eb = (setindex_t) mmap64(base, size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED_NOREPLACE, fd, 0);
+  if (llc->eb != base) {
+    perror("probe_init: eb: mmap");
+    exit(1);
+  }
+  if (fresh)
+    bindnode(llc->eb, size, llc->socket->node);
+  return !fresh && st.st_size == size && llc->eb[0].cachelines[0].next != NULL;
+}
+
+// Simulated buffers need no large pages, the fixed address keeps their frames
+static void ebsim(struct llc *llc, uint64_t size) {
+  void *base = (void *)(EB_FIXEDBASE + llc->socket->id * EB_STRIDE);
+  llc->eb = (setindex_t) mmap64(base, size, PROT_READ|PROT_WRITE, MAP_ANON|MAP_PRIVATE|MAP_FIXED_NOREPLACE, -1, 0);
+  if (llc->eb != base) {
+    perror("probe_init: eb: mmap");
+    exit(1);
+  }
+}
 
+static void *inittask(void *arg) {
+  struct llc *llc = arg;
+  uint64_t size = probeinfo.ebsetindices * SETINDEX_SIZE;
+  migrate(llc->socket->cpus[0]);
+  int linked = 0;
+  if (backend == &simbackend)
+    ebsim(llc, size);
+  else if (probeinfo.backing != NULL)
+    linked = ebfile(llc, size);
+  else
+    ebanon(llc, size);
+  llc->map = llcmap_new(llc->socket->id, llc->socket->node, probeinfo.ebsetindices, SETINDEX_LINES, SETINDEX_SIZE, llc->socket->ncores);
+
+  int f = backend == &hwbackend ? open("/proc/self/pagemap", O_RDONLY) : -1;
+  uint64_t buf;
+  uint64_t adrs = (uint64_t)llc->eb;
+  for (uint64_t p = 0; p < probeinfo.ebsetindices; p++) {
+    uint64_t va = adrs + p * SETINDEX_SIZE;
+    *(volatile char *)va;
+    if (f >= 0 && pread(f, &buf, sizeof(buf), va / PAGE_SIZE * 8) == sizeof(buf))
+      llc->map->frames[p] = (buf & PAGEMAP_PFN) * PAGE_SIZE;
+    else if (backend == &simbackend)
+      llc->map->frames[p] = va;
+  }
+  if (f >= 0)
+    close(f);
+  llcmap_sortframes(llc->map);
+  if (linked)
+    return NULL;
 
   pageset_t ps = ebpageset();
   int prev = 0;
   while (ps_size(ps)) {
     int next = ps_pop(ps);
     for (int i = 0; i < SETINDEX_LINES; i++) 
-      probeinfo.eb[prev].cachelines[i].next = &probeinfo.eb[next].cachelines[i];
+      llc->eb[prev].cachelines[i].next = &llc->eb[next].cachelines[i];
     prev = next;
   }
   for (int i = 0; i < SETINDEX_LINES; i++) 
-    probeinfo.eb[prev].cachelines[i].next = NULL;
+    llc->eb[prev].cachelines[i].next = NULL;
   ps_delete(ps);
+  return NULL;
+}
+
+void probe_setbacking(const char *path) {
+  probeinfo.backing = path;
+}
+
+void probe_setthreshold(int cycles) {
+  probeinfo.threshold = cycles;
+}
+
+// Split eviction walks with the sibling hyperthread, call before probe_init
+void probe_sethelper(int on) {
+  probeinfo.usehelper = on;
+}
+
+void probe_setpattern(const struct evictpattern *pat) {
+  probeinfo.pattern = *pat;
+}
+
+// Trials per pattern and the eviction rate, in thousandths, a pattern must reach
+#define CHAR_TRIALS	1000
+#define CHAR_RATE	995
+
+/*
+ * Window and repeat.  Patterns are characterised on lines of one slice but
+ * run over eb and quick sets with the slices interleaved, where a wider
+ * window would touch each slice in a different order.  A window of one
+ * keeps every slice's own access order, so only those are tried.
+ */
+static const int charwindows[][2] = { {1, 1}, {1, 2}, {1, 3} };
+
+static int patterncost(const struct evictpattern *pat, int n) {
+  return pat->passes * (n - pat->window + 1) * pat->repeat * pat->window;
+}
 
-  char ** data = probe_map();
-  for (int i = 0; i < SETINDEX_LINES; i++) {
-    for (int j = 0; j < probeinfo.ebsetindices; j++)
-      putchar('0' + data[i][j]);
-    putchar('\n');
+static int patterncmp(const void *v1, const void *v2) {
+  int n = probeinfo.nways + 1;
+  return patterncost(v1, n) - patterncost(v2, n);
+}
+
+/*
+ * Finds the cheapest access pattern that evicts a line with nways + 1 lines
+ * of its slice in CHAR_RATE of CHAR_TRIALS tries.  The slices come from
+ * splitting set index 0 of the first socket with the current pattern.
+ * Returns the accesses per eviction, or -1 and leaves best alone if no
+ * pattern is reliable.
+ */
+int probe_characterize(FILE *out, struct evictpattern *best) {
+  struct llc *llc = &probeinfo.llcs[0];
+  migrate(llc->socket->cpus[0]);
+  int n = probeinfo.nways + 1;
+  pageset_t *pss = split(llc, 0);
+  pageset_t group = NULL;
+  for (int i = 0; i < maxgroups(llc); i++)
+    if (pss[i] != NULL && ps_size(pss[i]) > n && (group == NULL || ps_size(pss[i]) > ps_size(group)))
+      group = pss[i];
+  int target = group != NULL ? ps_get(group, 0) : -1;
+  pageset_t evict = ps_new();
+  for (int i = 1; group != NULL && i <= n; i++)
+    ps_push(evict, ps_get(group, i));
+  for (int i = 0; i < maxgroups(llc); i++)
+    if (pss[i] != NULL)
+      ps_delete(pss[i]);
+  free(pss);
+  if (target < 0) {
+    fprintf(stderr, "probe_characterize: no slice with %d lines at set index 0\n", n + 1);
+    ps_delete(evict);
+    return -1;
   }
+
+  int npats = 0;
+  struct evictpattern pats[EVICT_COUNT * 2 * sizeof(charwindows) / sizeof(charwindows[0])];
+  for (int p = 1; p <= EVICT_COUNT; p++)
+    for (int w = 0; w < sizeof(charwindows) / sizeof(charwindows[0]); w++)
+      for (int z = 0; z <= (p > 1); z++)
+	pats[npats++] = (struct evictpattern){ p, charwindows[w][0], charwindows[w][1], z };
+  qsort(pats, npats, sizeof(pats[0]), patterncmp);
+
+  starthelper(llc);
+  struct evictpattern saved = probeinfo.pattern;
+  fprintf(out, "%d-line eviction set, %d trials, current pattern %d accesses\n", n, CHAR_TRIALS, patterncost(&saved, n));
+  fprintf(out, "passes window repeat zigzag accesses evicted\n");
+  ts_t ts = ts_alloc();
+  int rv = -1;
+  for (int i = 0; i < npats && rv < 0; i++) {
+    probeinfo.pattern = pats[i];
+    evictmeasureloop(llc, evict, target, 0, 1, ts, CHAR_TRIALS);
+    int hits = 0;
+    for (int tm = 1; tm < probeinfo.threshold && tm < TIME_MAX; tm++)
+      hits += ts_get(ts, tm);
+    int rate = (CHAR_TRIALS - hits) * 1000 / CHAR_TRIALS;
+    fprintf(out, "%6d %6d %6d %6d %8d %5.1f%%\n", pats[i].passes, pats[i].window, pats[i].repeat,
+	pats[i].zigzag, patterncost(&pats[i], n), rate / 10.0);
+    if (rate >= CHAR_RATE) {
+      *best = pats[i];
+      rv = patterncost(&pats[i], n);
+    }
+  }
+  probeinfo.pattern = saved;
+  stophelper(llc);
+  // Leave the set cold for the mapper
+  for (int p = 0; p < probeinfo.ebsetindices; p++)
+    probe_clflush(&llc->eb[p].cachelines[0]);
+  ts_free(ts);
+  ps_delete(evict);
+  return rv;
 }
 
+// Measure a simulated LLC instead of the hardware, call before probe_init
+void probe_setsim(struct simconfig *c) {
+  probeinfo.sim = *c;
+  probeinfo.acccount = ACCTIME_SIMCOUNT;
+  backend = &simbackend;
+  sim_init(c);
+  srandom(c->seed);
+}
+
+void probe_init(uint64_t ebsetindices) {
+  probeinfo.ebsetindices = ebsetindices  / SETINDEX_SIZE;
+  if (backend == &simbackend) {
+    probeinfo.nllcs = topo_synthetic(probeinfo.sim.nslices);
+    probeinfo.nways = probeinfo.sim.nways;
+  } else {
+    probeinfo.nllcs = topo_init();
+    probeinfo.nways = topo_nways();
+  }
+  if (debug && kernelfor(probeinfo.nways) == &chunked)
+    fprintf(stderr, "No kernel unrolled for %d ways, walking blocks of %d\n", probeinfo.nways, KERNEL_CHUNK);
+  for (int s = 0; s < probeinfo.nllcs; s++) {
+    probeinfo.llcs[s].socket = topo_socket(s);
+    probeinfo.llcs[s].todo = ps_new();
+    pthread_mutex_init(&probeinfo.llcs[s].lock, NULL);
+  }
+  foreachllc(inittask);
+  for (int s = 0; probeinfo.usehelper && backend == &hwbackend && s < probeinfo.nllcs; s++)
+    if (probeinfo.llcs[s].socket->siblings[0] < 0)
+      fprintf(stderr, "Socket %d: no sibling hyperthread, mapping without a helper\n", probeinfo.llcs[s].socket->id);
+}
+
+static struct llc *socketllc(int id) {
+  for (int s = 0; s < probeinfo.nllcs; s++)
+    if (probeinfo.llcs[s].socket->id == id)
+      return &probeinfo.llcs[s];
+  return NULL;
+}
+
+// Adopts the maps in f whose buffers still sit on the same physical frames
+int probe_loadmap(FILE *f) {
+  int rv = 0;
+  llcmap_t m;
+  while ((m = llcmap_read(f, SETINDEX_SIZE)) != NULL) {
+    struct llc *llc = socketllc(m->socket);
+    if (llc == NULL || m->npages != llc->map->npages || m->nlines != llc->map->nlines || m->ncores != llc->map->ncores) {
+      fprintf(stderr, "probe_loadmap: socket %d: map does not fit the buffer\n", m->socket);
+      llcmap_free(m);
+      continue;
+    }
+    int p;
+    for (p = 0; p < m->npages; p++)
+      if (m->frames[p] != llc->map->frames[p])
+	break;
+    if (p < m->npages) {
+      fprintf(stderr, "probe_loadmap: socket %d: page %d moved, map is stale\n", m->socket, p);
+      llcmap_free(m);
+      continue;
+    }
+    if (llc->map->frames[0] == 0)
+      fprintf(stderr, "probe_loadmap: socket %d: frames unknown, assuming map is current\n", m->socket);
+    for (int i = 0; i < m->nlines; i++) {
+      free(llc->map->slices[i]);
+      llc->map->slices[i] = m->slices[i];
+      m->slices[i] = NULL;
+    }
+    memcpy(llc->map->latency, m->latency, m->ncores * m->ncores * sizeof(int));
+    memcpy(llc->map->latcount, m->latcount, m->ncores * m->ncores * sizeof(int));
+    llcmap_free(m);
+    rv++;
+  }
+  return rv;
+}
+
+struct llcmap *probe_llcmap(int s) {
+  return s >= 0 && s < probeinfo.nllcs ? probeinfo.llcs[s].map : NULL;
+}
+
+void probe_writemap(FILE *f) {
+  for (int s = 0; s < probeinfo.nllcs; s++)
+    llcmap_write(f, probeinfo.llcs[s].map);
+}
 
+// Compares the map against the simulator, returns the num of wrong lines
+int probe_simcheck() {
+  if (backend != &simbackend)
+    return -1;
+  int wrong = 0, total = 0;
+  for (int s = 0; s < probeinfo.nllcs; s++) {
+    struct llc *llc = &probeinfo.llcs[s];
+    for (int i = 0; i < SETINDEX_LINES; i++) {
+      if (llc->map->slices[i] == NULL)
+	continue;
+      for (int p = 0; p < probeinfo.ebsetindices; p++) {
+	total++;
+	if (llc->map->slices[i][p] != sim_slice(&llc->eb[p].cachelines[i]))
+	  wrong++;
+      }
+    }
+  }
+  fprintf(stderr, "sim: %d of %d lines mapped to the wrong slice\n", wrong, total);
+  return wrong;
+}
+
+static double verifyconfidence, verifytolerance;
+static char verifyfailed[MAX_SOCKETS];
+
+// Pages other than page that the map puts in slice at set index si
+static pageset_t slicepages(struct llc *llc, int si, int slice, int page) {
+  pageset_t rv = ps_new();
+  for (int p = 0; p < probeinfo.ebsetindices; p++)
+    if (p != page && llc->map->slices[si][p] == slice)
+      ps_push(rv, p);
+  ps_randomise(rv);
+  return rv;
+}
+
+/*
+ * Each sampled line must be evicted by nways + 2 lines the map puts in its
+ * slice and survive as many lines from another slice.  Set indices with a
+ * failing line are queued for remapping, all of them if none was loaded.
+ */
+static void *verifytask(void *arg) {
+  struct llc *llc = arg;
+  char *result = &verifyfailed[llc - probeinfo.llcs];
+  *result = 1;
+  migrate(llc->socket->cpus[0]);
+  int ncores = llc->socket->ncores;
+  int nsets = 0;
+  int sets[SETINDEX_LINES];
+  for (int i = 0; i < SETINDEX_LINES; i++)
+    if (llc->map->slices[i] != NULL)
+      sets[nsets++] = i;
+  if (nsets == 0) {
+    fprintf(stderr, "Socket %d verify: nothing mapped, mapping every set index\n", llc->socket->id);
+    for (int i = SETINDEX_LINES - 1; i >= 0; i--)
+      ps_push(llc->todo, i);
+    return NULL;
+  }
+  starthelper(llc);
+  int n = (int)ceil(log(1 - verifyconfidence) / log(1 - verifytolerance));
+  int size = probeinfo.nways + 2;
+  char failed[SETINDEX_LINES] = { 0 };
+  int tested = 0, nfailed = 0;
+  ts_t ts = ts_alloc();
+  for (int tries = 0; tested < n && tries < 4 * n; tries++) {
+    int si = sets[random() % nsets];
+    int page = random() % probeinfo.ebsetindices;
+    int slice = llc->map->slices[si][page];
+    if (slice < 0 || ncores < 2)
+      continue;
+    int other = (slice + 1 + random() % (ncores - 1)) % ncores;
+    pageset_t same = slicepages(llc, si, slice, page);
+    pageset_t diff = slicepages(llc, si, other, page);
+    if (ps_size(same) >= size && ps_size(diff) >= size) {
+      while (ps_size(same) > size)
+	ps_pop(same);
+      while (ps_size(diff) > size)
+	ps_pop(diff);
+      tested++;
+      if (probe_evictMeasure(llc, same, page, si, ts, 32) < probeinfo.threshold ||
+	  probe_evictMeasure(llc, diff, page, si, ts, 32) >= probeinfo.threshold) {
+	nfailed++;
+	if (!failed[si])
+	  ps_push(llc->todo, si);
+	failed[si] = 1;
+      }
+    }
+    ps_delete(same);
+    ps_delete(diff);
+  }
+  ts_free(ts);
+  stophelper(llc);
+  fprintf(stderr, "Socket %d verify: %d of %d lines failed, %d set indices to remap\n", llc->socket->id, nfailed, tested, ps_size(llc->todo));
+  if (tested < n)
+    fprintf(stderr, "Socket %d verify: only %d of %d lines testable, slices too small\n", llc->socket->id, tested, n);
+  else if (nfailed == 0) {
+    fprintf(stderr, "Socket %d verify: pass, under %g%% of lines wrong with %g%% confidence\n", llc->socket->id, verifytolerance * 100, verifyconfidence * 100);
+    *result = 0;
+  } else
+    fprintf(stderr, "Socket %d verify: fail\n", llc->socket->id);
+  return NULL;
+}
+
+/*
+ * Tests enough random lines of every socket's map that, if none fails, fewer
+ * than tolerance of all lines are wrong with the given confidence.  Remaps
+ * the set indices of failing lines, or maps a socket afresh if nothing of it
+ * was loaded.  Returns the num of sockets whose map did not pass.
+ */
+int probe_verify(double confidence, double tolerance) {
+  verifyconfidence = confidence;
+  verifytolerance = tolerance;
+  foreachllc(verifytask);
+  foreachllc(maptask);
+  int rv = 0;
+  for (int s = 0; s < probeinfo.nllcs; s++)
+    rv += verifyfailed[s];
+  return rv;
+}
+
+// Maps the unmapped ones of n set indices on every socket
+void probe_mapsets(const int *setindices, int n) {
+  for (int s = 0; s < probeinfo.nllcs; s++) {
+    struct llc *llc = &probeinfo.llcs[s];
+    for (int i = 0; i < n; i++) {
+      int si = setindices[i];
+      if (si >= 0 && si < SETINDEX_LINES && llc->map->slices[si] == NULL)
+	ps_push(llc->todo, si);
+    }
+  }
+  foreachllc(maptask);
+}
+
+/*one socket's share of a probe_slices call*/
+struct lazyjob {
+  struct llc *llc;
+  void **addrs;
+  int n;
+  int *slices;      /*n results for this socket*/
+};
+
+// Physical address of p, 0 if pagemap does not give it
+static uint64_t physaddr(int pagemap, void *p) {
+  uint64_t va = (uint64_t)p, buf;
+  if (backend == &simbackend)
+    return va;
+  if (pagemap < 0 || pread(pagemap, &buf, sizeof(buf), va / PAGE_SIZE * sizeof(buf)) != sizeof(buf))
+    return 0;
+  if ((buf & PAGEMAP_PFN) == 0)
+    return 0;
+  return (buf & PAGEMAP_PFN) * PAGE_SIZE + va % PAGE_SIZE;
+}
+
+/*
+ * The slice whose nways + 2 lines at set index si alone evict p, -1 if
+ * none or more than one does.
+ */
+static int classify(struct llc *llc, void *p, int si, ts_t ts) {
+  int size = probeinfo.nways + 2;
+  int rv = -1;
+  for (int slice = 0; slice < llc->socket->ncores; slice++) {
+    pageset_t ps = slicepages(llc, si, slice, -1);
+    if (ps_size(ps) >= size) {
+      while (ps_size(ps) > size)
+	ps_pop(ps);
+      evictmeasureat(llc, ps, p, si, 1, ts, 32);
+      if (ts_median(ts) >= probeinfo.threshold) {
+	if (rv != -1) {
+	  ps_delete(ps);
+	  return -1;
+	}
+	rv = slice;
+      }
+    }
+    ps_delete(ps);
+  }
+  return rv;
+}
+
+/*
+ * Maps the set indices of the lazy addresses that are still unmapped, then
+ * reads their slices off the map if they lie in the buffer and measures
+ * them against each slice's lines if not.  Measured lines are remembered,
+ * by virtual address.
+ */
+static void *lazytask(void *arg) {
+  struct lazyjob *job = arg;
+  struct llc *llc = job->llc;
+  void **lazyaddrs = job->addrs;
+  int lazyn = job->n;
+  int *rv = job->slices;
+  pthread_mutex_lock(&llc->lock);
+  migrate(llc->socket->cpus[0]);
+  int pagemap = backend == &hwbackend ? open("/proc/self/pagemap", O_RDONLY) : -1;
+  uint64_t pa[lazyn];
+  int si[lazyn];
+  char queued[SETINDEX_LINES] = { 0 };
+  for (int i = 0; i < lazyn; i++) {
+    pa[i] = physaddr(pagemap, lazyaddrs[i]);
+    si[i] = pa[i] ? (int)(pa[i] >> CLBITS & (SETINDEX_LINES - 1)) : probe_setindex(lazyaddrs[i]);
+    if (si[i] >= 0 && llc->map->slices[si[i]] == NULL && !queued[si[i]]) {
+      ps_push(llc->todo, si[i]);
+      queued[si[i]] = 1;
+    }
+  }
+  if (pagemap >= 0)
+    close(pagemap);
+  starthelper(llc);
+  mapqueued(llc);
+  migrate(llc->socket->cpus[0]);
+
+  if (llc->memo == NULL)
+    llc->memo = calloc(MEMO_SIZE, sizeof(struct memo));
+  ts_t ts = ts_alloc();
+  for (int i = 0; i < lazyn; i++) {
+    rv[i] = -1;
+    if (si[i] < 0)
+      continue;
+    if (pa[i] && (rv[i] = llcmap_slice(llc->map, pa[i])) >= 0)
+      continue;
+    // by frame when known, a virtual line goes stale if its page migrates
+    uint64_t line = pa[i] ? (pa[i] >> CLBITS | MEMO_PHYS) : (uint64_t)lazyaddrs[i] >> CLBITS;
+    struct memo *m = &llc->memo[line % MEMO_SIZE];
+    if (m->line == line + 1) {
+      rv[i] = m->slice;
+      continue;
+    }
+    rv[i] = classify(llc, lazyaddrs[i], si[i], ts);
+    if (rv[i] >= 0) {
+      m->line = line + 1;
+      m->slice = rv[i];
+    }
+  }
+  ts_free(ts);
+  stophelper(llc);
+  pthread_mutex_unlock(&llc->lock);
+  return NULL;
+}
+
+/*
+ * Slices of n lines on every socket, slices[s * n + i] for the i'th line on
+ * socket s, -1 if unknown.  Only the set indices the lines fall in get
+ * mapped, once, sockets in parallel.  Returns the num of lines found.
+ */
+int probe_slices(void **addrs, int n, int *slices) {
+  struct lazyjob jobs[MAX_SOCKETS];
+  for (int s = 0; s < probeinfo.nllcs; s++)
+    jobs[s] = (struct lazyjob){ &probeinfo.llcs[s], addrs, n, slices + s * n };
+  runthreads(lazytask, jobs, sizeof(struct lazyjob));
+  int rv = 0;
+  for (int i = 0; i < n * probeinfo.nllcs; i++)
+    rv += slices[i] >= 0;
+  return rv;
+}
@@ -17,19 +17,48 @@
 #ifndef __PROBE_H__
 #define __PROBE_H__ 1
 
-void probe_clflush(void *p);
-void probe_access(void *p);
+/*how an eviction set is accessed to evict a line*/
+struct evictpattern {
+  int passes;   /*traversals of the eviction set*/
+  int window;   /*lines accessed together, sliding one line per step*/
+  int repeat;   /*accesses of each window position*/
+  int zigzag;   /*odd passes run backwards*/
+};
+
+void probe_clflush(volatile void *p);
+void probe_access(volatile void *p);
 int probe_setindex(void *p);
 void probe_evict(int si);
-int probe_time(void *p);
+int probe_time(volatile void *p);
+void probe_setbacking(const char *path);
+void probe_setthreshold(int cycles);
+void probe_setpattern(const struct evictpattern *pat);
+void probe_sethelper(int on);
+int probe_characterize(FILE *out, struct evictpattern *best);
 void probe_init(uint64_t ebsize);
+void probe_map(int first, int last);
+// Lazy use, after probe_init map only what is asked for
+void probe_mapsets(const int *setindices, int n);
+int probe_slices(void **addrs, int n, int *slices);
+int probe_loadmap(FILE *f);
+void probe_writemap(FILE *f);
+struct llcmap;
+// The map of the s'th socket, NULL past the last
+struct llcmap *probe_llcmap(int s);
+int probe_verify(double confidence, double tolerance);
 
 // Hardware and config info
 int probe_npages();
 int probe_noffsets();
 int probe_nways();
 int probe_ncores();
+int probe_nsockets();
 int probe_pagesize();
 
+// Simulated LLC, see sim.h
+struct simconfig;
+void probe_setsim(struct simconfig *c);
+int probe_simcheck();
+
 
 #endif // __PROBE_H__
@@ -0,0 +1,188 @@
+/*
+ * Copyright 2015 The University of Adelaide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "probe.h"
+#include "timestats.h"
+#include "sysinfo.h"
+#include "profile.h"
+
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB	(21 << 26)
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB	(30 << 26)
+#endif
+
+#define PROF_CLSIZE	64
+#define PROF_MINSIZE	(16 * KB)
+#define PROF_SAMPLES	20000
+#define PROF_MAXSIZES	64
+
+// Consecutive medians within PROF_FLAT percent are one level
+#define PROF_FLAT	110
+// Levels slower than PROF_DRAM percent of the flushed latency are memory
+#define PROF_DRAM	80
+// Eviction buffer per byte of LLC
+#define PROF_EBMULT	16
+// A level within this factor of the reported LLC size can be the LLC
+#define PROF_NEAR	4
+
+struct pagekind {
+  const char *name;
+  uint64_t size;
+  int flags;
+};
+
+static const struct pagekind kinds[] = {
+  { "4K", 4 * KB, 0 },
+  { "2M", 2 * MB, MAP_HUGETLB | MAP_HUGE_2MB },
+  { "1G", GB, MAP_HUGETLB | MAP_HUGE_1GB },
+};
+
+// A random cycle through every line of the first size bytes of buf
+static void **chase(char *buf, uint64_t size) {
+  uint64_t lines = size / PROF_CLSIZE;
+  uint32_t *perm = malloc(lines * sizeof(uint32_t));
+  for (uint64_t i = 0; i < lines; i++)
+    perm[i] = i;
+  for (uint64_t i = lines - 1; i > 0; i--) {
+    uint64_t j = random() % (i + 1);
+    uint32_t t = perm[i];
+    perm[i] = perm[j];
+    perm[j] = t;
+  }
+  for (uint64_t i = 0; i < lines; i++)
+    *(void **)(buf + perm[i] * PROF_CLSIZE) = buf + perm[(i + 1) % lines] * PROF_CLSIZE;
+  void **rv = (void **)(buf + perm[0] * PROF_CLSIZE);
+  free(perm);
+  return rv;
+}
+
+// Each timed line was last touched a whole cycle, size bytes, ago
+static void measure(ts_t ts, char *buf, uint64_t size) {
+  void **p = chase(buf, size);
+  for (uint64_t i = size / PROF_CLSIZE; i--; )
+    p = *p;
+  ts_clear(ts);
+  for (int i = 0; i < PROF_SAMPLES; i++) {
+    ts_add(ts, probe_time(p));
+    p = *p;
+  }
+}
+
+static int flushed(ts_t ts, char *buf) {
+  ts_clear(ts);
+  for (int i = 0; i < PROF_SAMPLES; i++) {
+    probe_clflush(buf);
+    ts_add(ts, probe_time(buf));
+  }
+  return ts_median(ts);
+}
+
+static int levels(struct profile *pf, uint64_t *sizes, int *medians, int n) {
+  pf->nlevels = 0;
+  pf->llc = -1;
+  int start = 0;
+  for (int i = 1; i <= n; i++) {
+    if (i < n && medians[i] * 100 <= medians[i - 1] * PROF_FLAT)
+      continue;
+    // a plateau of at least two sizes is a level
+    if (i - start >= 2 && pf->nlevels < PROF_MAXLEVELS && medians[start] * 100 < pf->dram * PROF_DRAM) {
+      struct proflevel *l = &pf->levels[pf->nlevels++];
+      l->size = sizes[i - 1];
+      l->latency = medians[(start + i - 1) / 2];
+    }
+    start = i;
+  }
+  if (pf->nlevels > 0)
+    pf->llc = pf->nlevels - 1;
+  return pf->nlevels;
+}
+
+int profile(FILE *out, uint64_t maxsize, struct profile *pf) {
+  ts_t ts = ts_alloc();
+  uint64_t sizes[PROF_MAXSIZES];
+  int medians[PROF_MAXSIZES];
+  int rv = -1;
+  fprintf(out, "#pages size median p10 p90 p99\n");
+  for (int k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++) {
+    uint64_t len = (maxsize + kinds[k].size - 1) / kinds[k].size * kinds[k].size;
+    char *buf = mmap(NULL, len, PROT_READ|PROT_WRITE, MAP_ANON|MAP_PRIVATE|kinds[k].flags, -1, 0);
+    if (buf == MAP_FAILED) {
+      fprintf(out, "# %s pages unavailable\n", kinds[k].name);
+      continue;
+    }
+    if (kinds[k].flags == 0)
+      madvise(buf, len, MADV_NOHUGEPAGE);
+    int n = 0;
+    for (uint64_t size = PROF_MINSIZE; size <= maxsize && n < PROF_MAXSIZES; n++) {
+      measure(ts, buf, size);
+      sizes[n] = size;
+      medians[n] = ts_median(ts);
+      fprintf(out, "%s %llu %d %d %d %d\n", kinds[k].name, (unsigned long long)size, medians[n],
+	  ts_percentile(ts, 10), ts_percentile(ts, 90), ts_percentile(ts, 99));
+      // steps of 1.5 and 4/3 alternate between powers of two
+      size = (size & (size - 1)) ? size / 3 * 4 : size / 2 * 3;
+    }
+    struct profile p;
+    p.dram = flushed(ts, buf);
+    levels(&p, sizes, medians, n);
+    fprintf(out, "# %s levels:", kinds[k].name);
+    for (int i = 0; i < p.nlevels; i++)
+      fprintf(out, " %llu:%d", (unsigned long long)p.levels[i].size, p.levels[i].latency);
+    fprintf(out, " dram:%d\n", p.dram);
+    munmap(buf, len);
+    if (p.llc >= 0) {
+      *pf = p;
+      rv = 0;
+    }
+  }
+  ts_free(ts);
+  return rv;
+}
+
+int profile_nearest(struct profile *pf, uint64_t size) {
+  int best = -1;
+  double bestratio = 0;
+  for (int i = 0; i < pf->nlevels; i++) {
+    double r = (double)pf->levels[i].size / size;
+    if (r < 1)
+      r = 1 / r;
+    if (best < 0 || r < bestratio) {
+      best = i;
+      bestratio = r;
+    }
+  }
+  if (best < 0 || bestratio > PROF_NEAR)
+    return -1;
+  pf->llc = best;
+  return 0;
+}
+
+int profile_threshold(struct profile *pf) {
+  return (pf->levels[pf->llc].latency + pf->dram) / 2;
+}
+
+uint64_t profile_ebsize(struct profile *pf) {
+  uint64_t rv = pf->levels[pf->llc].size * PROF_EBMULT;
+  return (rv + 2 * MB - 1) / (2 * MB) * (2 * MB);
+}
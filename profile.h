@@ -0,0 +1,50 @@
+/*
+ * Copyright 2015 The University of Adelaide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __PROFILE_H__
+#define __PROFILE_H__ 1
+
+#define PROF_MAXLEVELS	8
+
+/*one plateau of the latency curve*/
+struct proflevel {
+  uint64_t size;   /*largest working set measured at this latency*/
+  int latency;     /*median cycles*/
+};
+
+struct profile {
+  int nlevels;
+  struct proflevel levels[PROF_MAXLEVELS];
+  int dram;        /*median cycles to a flushed line*/
+  int llc;         /*index of the LLC level, -1 if not found*/
+};
+
+/*
+ * Times randomised pointer chases over working sets from 16KB to maxsize on
+ * 4KB, 2MB and 1GB pages, printing the latency percentiles of each.  Fills
+ * pf from the largest pages that could be allocated and returns 0, or -1 if
+ * no cache levels were found.
+ */
+int profile(FILE *out, uint64_t maxsize, struct profile *pf);
+
+// Takes the level nearest size as the LLC, -1 and pf unchanged if none is close
+int profile_nearest(struct profile *pf, uint64_t size);
+
+// Threshold between LLC hits and misses, and a buffer size for the mapper
+int profile_threshold(struct profile *pf);
+uint64_t profile_ebsize(struct profile *pf);
+
+#endif // __PROFILE_H__
@@ -0,0 +1,341 @@
+/*
+ * Copyright 2015 The University of Adelaide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/syscall.h>
+
+#include "llcmap.h"
+#include "topology.h"
+#include "service.h"
+
+#define PM_PAGE		4096
+#define PM_PRESENT	(1ULL << 63)
+#define PM_PFN		((1ULL << 55) - 1)
+
+struct service {
+  struct shmheader *h;
+  uint64_t size;
+};
+
+static llcmap_t *servmaps;
+static int nservmaps;
+
+static void sockname(struct sockaddr_un *sa, const char *name) {
+  memset(sa, 0, sizeof(*sa));
+  sa->sun_family = AF_UNIX;
+  snprintf(sa->sun_path, sizeof(sa->sun_path), SERVICE_SOCKDIR "/%s.sock", name);
+}
+
+static uint64_t align8(uint64_t n) {
+  return (n + 7) & ~7ULL;
+}
+
+static uint64_t mapbytes(llcmap_t m) {
+  return align8(m->npages * sizeof(uint64_t)) + align8(m->npages * sizeof(int)) +
+    align8((uint64_t)m->nlines * m->npages) + align8(m->ncores * m->ncores * sizeof(int));
+}
+
+/*
+ * Lays the maps out after the header, between the two seq increments so
+ * that readers never use a half written map.
+ */
+static void publish(struct shmheader *h, llcmap_t *maps, int nmaps) {
+  __atomic_store_n(&h->seq, h->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  h->nmaps = nmaps;
+  uint64_t off = align8(sizeof(struct shmheader));
+  char *base = (char *)h;
+  for (int i = 0; i < nmaps; i++) {
+    llcmap_t m = maps[i];
+    struct shmmap *sm = &h->maps[i];
+    sm->socket = m->socket;
+    sm->node = m->node;
+    sm->npages = m->npages;
+    sm->nlines = m->nlines;
+    sm->ncores = m->ncores;
+    sm->pagesize = m->pagesize;
+    sm->hashbits = m->hashbits;
+    memcpy(sm->hash, m->hash, sizeof(sm->hash));
+    memcpy(sm->hashslice, m->hashslice, sizeof(sm->hashslice));
+    sm->hashref = m->hashref;
+    sm->hashvarying = m->hashvarying;
+    sm->frames = off;
+    memcpy(base + off, m->frames, m->npages * sizeof(uint64_t));
+    off += align8(m->npages * sizeof(uint64_t));
+    sm->byframe = off;
+    memcpy(base + off, m->byframe, m->npages * sizeof(int));
+    off += align8(m->npages * sizeof(int));
+    sm->slices = off;
+    for (int l = 0; l < m->nlines; l++) {
+      char *row = base + off + (uint64_t)l * m->npages;
+      if (m->slices[l] == NULL)
+	memset(row, -1, m->npages);
+      else
+	memcpy(row, m->slices[l], m->npages);
+    }
+    off += align8((uint64_t)m->nlines * m->npages);
+    sm->latency = off;
+    memcpy(base + off, m->latency, m->ncores * m->ncores * sizeof(int));
+    off += align8(m->ncores * m->ncores * sizeof(int));
+  }
+  h->size = off;
+  h->magic = SERVICE_MAGIC;
+  __atomic_store_n(&h->seq, h->seq + 1, __ATOMIC_RELEASE);
+}
+
+static int virtslice(int pagemap, llcmap_t m, uint64_t va) {
+  uint64_t pm;
+  if (pagemap < 0 || pread(pagemap, &pm, sizeof(pm), va / PM_PAGE * sizeof(pm)) != sizeof(pm))
+    return -1;
+  if (!(pm & PM_PRESENT) || (pm & PM_PFN) == 0)
+    return -1;
+  return llcmap_slice(m, (pm & PM_PFN) * PM_PAGE + va % PM_PAGE);
+}
+
+/*
+ * The peer's page table, -1 unless /proc/<pid> still belongs to the peer's
+ * uid (not a setuid image it ran since) and, by its pidfd, the pid was not
+ * reused before the open.
+ */
+static int peerpagemap(int fd) {
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+    return -1;
+  int pidfd = -1;
+#ifdef SO_PEERPIDFD
+  len = sizeof(pidfd);
+  if (getsockopt(fd, SOL_SOCKET, SO_PEERPIDFD, &pidfd, &len) < 0)
+    pidfd = -1;
+#endif
+  if (pidfd < 0)
+    pidfd = syscall(SYS_pidfd_open, cred.pid, 0);
+  if (pidfd < 0)
+    return -1;
+  char name[64];
+  sprintf(name, "/proc/%d", cred.pid);
+  int dir = open(name, O_RDONLY|O_DIRECTORY);
+  struct stat st;
+  int rv = -1;
+  if (dir >= 0 && fstat(dir, &st) == 0 && st.st_uid == cred.uid)
+    rv = openat(dir, "pagemap", O_RDONLY);
+  if (rv >= 0 && syscall(SYS_pidfd_send_signal, pidfd, 0, NULL, 0) < 0) {
+    close(rv);
+    rv = -1;
+  }
+  if (dir >= 0)
+    close(dir);
+  close(pidfd);
+  return rv;
+}
+
+// Answers one client until it hangs up, virtual addresses are its own
+static void *serve(void *arg) {
+  int fd = (intptr_t)arg;
+  int pagemap = peerpagemap(fd);
+  struct servicereq req;
+  while (read(fd, &req, sizeof(req)) == sizeof(req)) {
+    int slice = -1;
+    if (req.map >= 0 && req.map < nservmaps)
+      slice = req.virt ? virtslice(pagemap, servmaps[req.map], req.addr) : llcmap_slice(servmaps[req.map], req.addr);
+    if (send(fd, &slice, sizeof(slice), MSG_NOSIGNAL) != sizeof(slice))
+      break;
+  }
+  if (pagemap >= 0)
+    close(pagemap);
+  close(fd);
+  return NULL;
+}
+
+void service_run(const char *name, llcmap_t *maps, int nmaps) {
+  servmaps = maps;
+  nservmaps = nmaps;
+  uint64_t size = align8(sizeof(struct shmheader));
+  for (int i = 0; i < nmaps; i++) {
+    if (llcmap_inferhash(maps[i]) < 0 || maps[i]->hashbits == 0)
+      fprintf(stderr, "service: socket %d: no XOR hash fits the map\n", maps[i]->socket);
+    size += mapbytes(maps[i]);
+  }
+
+  char shmname[256];
+  snprintf(shmname, sizeof(shmname), "/%s", name);
+  int fd = shm_open(shmname, O_CREAT|O_RDWR, 0644);
+  if (fd < 0 || ftruncate(fd, size) < 0) {
+    perror(shmname);
+    exit(1);
+  }
+  struct shmheader *h = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if (h == MAP_FAILED) {
+    perror("service: mmap");
+    exit(1);
+  }
+  close(fd);
+  publish(h, maps, nmaps);
+
+  struct sockaddr_un sa;
+  sockname(&sa, name);
+  int s = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(sa.sun_path);
+  if (s < 0 || bind(s, (struct sockaddr *)&sa, sizeof(sa)) < 0 || listen(s, 16) < 0) {
+    perror(sa.sun_path);
+    exit(1);
+  }
+  chmod(sa.sun_path, 0666);
+  fprintf(stderr, "service: %d maps in /dev/shm%s, queries on %s\n", nmaps, shmname, sa.sun_path);
+  for (;;) {
+    int c = accept(s, NULL, NULL);
+    if (c < 0) {
+      perror("service: accept");
+      continue;
+    }
+    pthread_t t;
+    if (pthread_create(&t, NULL, serve, (void *)(intptr_t)c) != 0) {
+      close(c);
+      continue;
+    }
+    pthread_detach(t);
+  }
+}
+
+service_t service_open(const char *name) {
+  char shmname[256];
+  snprintf(shmname, sizeof(shmname), "/%s", name);
+  int fd = shm_open(shmname, O_RDONLY, 0);
+  if (fd < 0)
+    return NULL;
+  struct stat st;
+  if (fstat(fd, &st) < 0 || st.st_size < sizeof(struct shmheader)) {
+    close(fd);
+    return NULL;
+  }
+  void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED)
+    return NULL;
+  service_t rv = malloc(sizeof(struct service));
+  rv->h = p;
+  rv->size = st.st_size;
+  return rv;
+}
+
+void service_close(service_t s) {
+  if (s == NULL)
+    return;
+  munmap(s->h, s->size);
+  free(s);
+}
+
+int service_nmaps(service_t s) {
+  return s->h->magic == SERVICE_MAGIC ? s->h->nmaps : 0;
+}
+
+static int inside(service_t s, uint64_t off, uint64_t len) {
+  return off >= sizeof(struct shmheader) && off <= s->size && len <= s->size - off;
+}
+
+/*
+ * The same lookup as llcmap_slice on the segment.  Fields may be torn by a
+ * concurrent publish, so every offset and index is checked before use and
+ * the caller throws the answer away if seq moved.
+ */
+static int lookup(service_t s, int map, uint64_t pa) {
+  struct shmheader *h = s->h;
+  if (h->magic != SERVICE_MAGIC || map < 0 || map >= h->nmaps || map >= MAX_SOCKETS)
+    return -1;
+  const struct shmmap *m = &h->maps[map];
+  int npages = m->npages, nlines = m->nlines;
+  if (npages <= 0 || nlines <= 0 || !inside(s, m->frames, npages * sizeof(uint64_t)) ||
+      !inside(s, m->byframe, npages * sizeof(int)) || !inside(s, m->slices, (uint64_t)nlines * npages))
+    return -1;
+  const char *base = (const char *)h;
+  const uint64_t *frames = (const uint64_t *)(base + m->frames);
+  const int *byframe = (const int *)(base + m->byframe);
+  const char *slices = base + m->slices;
+  int lo = 0, hi = npages;
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    int p = byframe[mid];
+    if (p < 0 || p >= npages)
+      return -1;
+    if (frames[p] <= pa)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  if (lo > 0) {
+    int p = byframe[lo - 1];
+    uint64_t off = pa - frames[p];
+    if (frames[p] != 0 && off < m->pagesize) {
+      int i = off / LLCMAP_CLSIZE % nlines;
+      int slice = slices[(uint64_t)i * npages + p];
+      if (slice >= 0)
+	return slice;
+    }
+  }
+  int bits = m->hashbits;
+  if (bits <= 0 || bits > LLCMAP_MAXHASH || ((pa ^ m->hashref) & ~m->hashvarying & ~(uint64_t)(LLCMAP_CLSIZE - 1)))
+    return -1;
+  int v = 0;
+  for (int i = 0; i < bits; i++)
+    v |= __builtin_parityll(pa & m->hash[i]) << i;
+  return m->hashslice[v];
+}
+
+int service_slice(service_t s, int map, uint64_t pa) {
+  for (;;) {
+    unsigned seq = __atomic_load_n(&s->h->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) {
+      asm __volatile__ ("pause");
+      continue;
+    }
+    int rv = lookup(s, map, pa);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&s->h->seq, __ATOMIC_RELAXED) == seq)
+      return rv;
+  }
+}
+
+int service_connect(const char *name) {
+  struct sockaddr_un sa;
+  sockname(&sa, name);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0)
+    return -1;
+  if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int service_query(int fd, int map, uint64_t addr, int virt) {
+  struct servicereq req = { virt, map, addr };
+  int slice;
+  if (write(fd, &req, sizeof(req)) != sizeof(req) || read(fd, &slice, sizeof(slice)) != sizeof(slice))
+    return -1;
+  return slice;
+}
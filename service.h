@@ -0,0 +1,81 @@
+/*
+ * Copyright 2015 The University of Adelaide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SERVICE_H__
+#define __SERVICE_H__ 1
+
+#define SERVICE_MAGIC	0x6d63636cU
+#define SERVICE_SOCKDIR	"/tmp"
+
+/*one socket's map in the segment, arrays at byte offsets from its start*/
+struct shmmap {
+  int socket;
+  int node;
+  int npages;
+  int nlines;
+  int ncores;
+  int pagesize;
+  int hashbits;
+  uint64_t hash[LLCMAP_MAXHASH];
+  char hashslice[1 << LLCMAP_MAXHASH];
+  uint64_t hashref;   /*the hash holds for addresses that differ from hashref*/
+  uint64_t hashvarying; /*only in these bits*/
+  uint64_t frames;    /*uint64_t[npages], physical address of each page*/
+  uint64_t byframe;   /*int[npages], pages sorted by frame*/
+  uint64_t slices;    /*char[nlines][npages], -1 if unmapped*/
+  uint64_t latency;   /*int[ncores][ncores] in tenths of a cycle*/
+};
+
+/*
+ * Head of the read-only segment /<name>.  seq is odd while the server
+ * rewrites the maps, readers retry a lookup if it changed under them.
+ */
+struct shmheader {
+  uint32_t magic;
+  unsigned seq;
+  uint64_t size;      /*bytes in the segment*/
+  int nmaps;
+  struct shmmap maps[MAX_SOCKETS];
+};
+
+/*a request on the socket SERVICE_SOCKDIR/<name>.sock*/
+struct servicereq {
+  int virt;           /*addr is virtual in the asking process*/
+  int map;            /*index of the socket's map*/
+  uint64_t addr;
+};
+
+// Publishes the maps in /<name> and answers queries on its socket, never returns
+void service_run(const char *name, llcmap_t *maps, int nmaps);
+
+typedef struct service *service_t;
+
+// Maps the segment of a running service read-only, NULL if there is none
+service_t service_open(const char *name);
+void service_close(service_t s);
+int service_nmaps(service_t s);
+
+// Slice of a physical address in map, without locks or syscalls, -1 if unknown
+int service_slice(service_t s, int map, uint64_t pa);
+
+// Connects to the service's socket, -1 on failure
+int service_connect(const char *name);
+
+// Asks the service for the slice of an address, virtual ones are looked up in
+// the caller's page table, -1 if unknown
+int service_query(int fd, int map, uint64_t addr, int virt);
+
+#endif // __SERVICE_H__
@@ -0,0 +1,248 @@
+/*
+ * Copyright 2015 The University of Adelaide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+
+#include "sim.h"
+#include "sysinfo.h"
+
+#define SIM_CLBITS	6
+#define SIM_RRPVMAX	3
+#define SIM_OUTLIER	2000
+
+static struct simconfig cfg;
+static uint64_t *tags;     /*line address + 1 per way, 0 if invalid*/
+static uint32_t *stamps;   /*last use (LRU), fill time (FIFO) or RRPV (SRRIP)*/
+static uint32_t clock;
+static uint32_t rng;
+static int core;
+static char busy;          /*the mapping thread and its helper may both access*/
+
+// Known hash functions of 2^n slice Intel parts
+static const uint64_t inthash[] = {
+  0x1b5f575440ULL,
+  0x2eb5faa880ULL,
+  0x3cccc93100ULL,
+};
+
+void sim_defaults(struct simconfig *c) {
+  memset(c, 0, sizeof(*c));
+  c->nslices = NCORES;
+  c->nsets = 2048;
+  c->nways = NWAYS;
+  c->policy = SIM_LRU;
+  c->nhash = sizeof(inthash) / sizeof(inthash[0]);
+  memcpy(c->hash, inthash, sizeof(inthash));
+  c->hit = 40;
+  c->hop = 2;
+  c->miss = 200;
+  c->noise = 4;
+  c->outliers = 0;
+  c->seed = 1;
+}
+
+static int parsepolicy(const char *s) {
+  static const char *names[] = { "lru", "fifo", "random", "srrip" };
+  for (int i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+    if (strcmp(s, names[i]) == 0)
+      return i;
+  return -1;
+}
+
+int sim_parse(struct simconfig *c, const char *spec) {
+  char *buf = strdup(spec);
+  char *save;
+  int rv = 0;
+  for (char *kv = strtok_r(buf, ",", &save); kv != NULL; kv = strtok_r(NULL, ",", &save)) {
+    char *v = strchr(kv, '=');
+    if (v == NULL) {
+      rv = -1;
+      break;
+    }
+    *v++ = '\0';
+    if (strcmp(kv, "slices") == 0)
+      c->nslices = atoi(v);
+    else if (strcmp(kv, "sets") == 0)
+      c->nsets = atoi(v);
+    else if (strcmp(kv, "ways") == 0)
+      c->nways = atoi(v);
+    else if (strcmp(kv, "policy") == 0) {
+      int p = parsepolicy(v);
+      if (p < 0) {
+	rv = -1;
+	break;
+      }
+      c->policy = p;
+    } else if (strcmp(kv, "hash") == 0) {
+      c->nhash = 0;
+      for (char *m = strtok(v, ":"); m != NULL && c->nhash < SIM_MAXHASH; m = strtok(NULL, ":"))
+	c->hash[c->nhash++] = strtoull(m, NULL, 16);
+    } else if (strcmp(kv, "hit") == 0)
+      c->hit = atoi(v);
+    else if (strcmp(kv, "hop") == 0)
+      c->hop = atoi(v);
+    else if (strcmp(kv, "miss") == 0)
+      c->miss = atoi(v);
+    else if (strcmp(kv, "noise") == 0)
+      c->noise = atoi(v);
+    else if (strcmp(kv, "outliers") == 0)
+      c->outliers = atoi(v);
+    else if (strcmp(kv, "seed") == 0)
+      c->seed = strtoul(v, NULL, 0);
+    else {
+      rv = -1;
+      break;
+    }
+  }
+  free(buf);
+  if (c->nslices <= 0 || c->nsets <= 0 || (c->nsets & (c->nsets - 1)) || c->nways <= 0)
+    rv = -1;
+  // n hash functions only reach 2^n slices
+  if (c->nslices > 1 << c->nhash) {
+    fprintf(stderr, "sim: %d slices need more than %d hash functions\n", c->nslices, c->nhash);
+    rv = -1;
+  }
+  return rv;
+}
+
+static uint32_t simrandom() {
+  rng ^= rng << 13;
+  rng ^= rng >> 17;
+  rng ^= rng << 5;
+  return rng;
+}
+
+void sim_init(struct simconfig *c) {
+  cfg = *c;
+  free(tags);
+  free(stamps);
+  size_t n = (size_t)cfg.nslices * cfg.nsets * cfg.nways;
+  tags = calloc(n, sizeof(uint64_t));
+  stamps = calloc(n, sizeof(uint32_t));
+  clock = 0;
+  rng = cfg.seed ? cfg.seed : 1;
+  core = 0;
+}
+
+void sim_setcore(int c) {
+  core = c % cfg.nslices;
+}
+
+int sim_slice(volatile void *p) {
+  uint64_t a = (uint64_t)p;
+  int h = 0;
+  for (int i = 0; i < cfg.nhash; i++)
+    h |= __builtin_parityll(a & cfg.hash[i]) << i;
+  return h % cfg.nslices;
+}
+
+static uint64_t *setof(volatile void *p, uint32_t **st) {
+  uint64_t set = ((uint64_t)p >> SIM_CLBITS) & (cfg.nsets - 1);
+  size_t base = ((size_t)sim_slice(p) * cfg.nsets + set) * cfg.nways;
+  *st = stamps + base;
+  return tags + base;
+}
+
+static int victim(uint64_t *t, uint32_t *st) {
+  for (int w = 0; w < cfg.nways; w++)
+    if (t[w] == 0)
+      return w;
+  int v = 0;
+  switch (cfg.policy) {
+    case SIM_RANDOM:
+      return simrandom() % cfg.nways;
+    case SIM_SRRIP:
+      for (;;) {
+	for (int w = 0; w < cfg.nways; w++)
+	  if (st[w] >= SIM_RRPVMAX)
+	    return w;
+	for (int w = 0; w < cfg.nways; w++)
+	  st[w]++;
+      }
+    default:
+      for (int w = 1; w < cfg.nways; w++)
+	if (st[w] < st[v])
+	  v = w;
+      return v;
+  }
+}
+
+// Returns 1 on a hit, otherwise fills the line
+static int lookup(volatile void *p) {
+  uint32_t *st;
+  uint64_t *t = setof(p, &st);
+  uint64_t tag = ((uint64_t)p >> SIM_CLBITS) + 1;
+  clock++;
+  for (int w = 0; w < cfg.nways; w++) {
+    if (t[w] == tag) {
+      if (cfg.policy == SIM_LRU)
+	st[w] = clock;
+      else if (cfg.policy == SIM_SRRIP)
+	st[w] = 0;
+      return 1;
+    }
+  }
+  int w = victim(t, st);
+  t[w] = tag;
+  st[w] = cfg.policy == SIM_SRRIP ? SIM_RRPVMAX - 1 : clock;
+  return 0;
+}
+
+static void lock() {
+  while (__atomic_test_and_set(&busy, __ATOMIC_ACQUIRE))
+    sched_yield();
+}
+
+static void unlock() {
+  __atomic_clear(&busy, __ATOMIC_RELEASE);
+}
+
+void sim_access(volatile void *p) {
+  lock();
+  lookup(p);
+  unlock();
+}
+
+int sim_time(volatile void *p) {
+  int slice = sim_slice(p);
+  int rv;
+  lock();
+  if (lookup(p))
+    rv = cfg.hit + cfg.hop * abs(slice - core);
+  else
+    rv = cfg.miss;
+  if (cfg.noise)
+    rv += simrandom() % (cfg.noise + 1);
+  if (cfg.outliers && simrandom() % cfg.outliers == 0)
+    rv += SIM_OUTLIER;
+  unlock();
+  return rv;
+}
+
+void sim_clflush(volatile void *p) {
+  uint32_t *st;
+  uint64_t *t = setof(p, &st);
+  uint64_t tag = ((uint64_t)p >> SIM_CLBITS) + 1;
+  lock();
+  for (int w = 0; w < cfg.nways; w++)
+    if (t[w] == tag)
+      t[w] = 0;
+  unlock();
+}
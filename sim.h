@@ -0,0 +1,53 @@
+/*
+ * Copyright 2015 The University of Adelaide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __SIM_H__
+#define __SIM_H__ 1
+
+#define SIM_MAXHASH	8
+
+enum simpolicy { SIM_LRU, SIM_FIFO, SIM_RANDOM, SIM_SRRIP };
+
+/*a sliced, set-associative LLC*/
+struct simconfig {
+  int nslices;
+  int nsets;                   /*sets per slice*/
+  int nways;
+  enum simpolicy policy;
+  int nhash;                   /*num of XOR hash functions*/
+  uint64_t hash[SIM_MAXHASH];  /*slice = parity bits of address & hash[i], mod nslices*/
+  int hit;                     /*hit latency in the core's own slice*/
+  int hop;                     /*extra hit latency per slice between core and slice*/
+  int miss;                    /*memory latency*/
+  int noise;                   /*uniform jitter added to every time*/
+  int outliers;                /*one time in outliers is an interrupt, 0 for none*/
+  uint32_t seed;
+};
+
+void sim_defaults(struct simconfig *c);
+// Parses comma separated key=value pairs, e.g. "slices=4,policy=srrip,noise=8"
+int sim_parse(struct simconfig *c, const char *spec);
+void sim_init(struct simconfig *c);
+
+void sim_setcore(int core);
+void sim_access(volatile void *p);
+int sim_time(volatile void *p);
+void sim_clflush(volatile void *p);
+
+// The slice an address really maps to
+int sim_slice(volatile void *p);
+
+#endif // __SIM_H__
@@ -21,6 +21,7 @@
 #define MB 	(1024 * KB)
 #define GB	(1024 * MB)
 
+// Used only when the topology cannot be read from sysfs
 #define NCORES 6
 #define COREID(c) (c * 2)
 #define NWAYS 20
@@ -36,6 +36,9 @@ uint32_t ts_outliers(ts_t ts);
 
 int ts_median(ts_t ts);
 
+// 0 if the percentile falls among the outliers
+int ts_percentile(ts_t ts, int pct);
+
 int ts_mean(ts_t ts, int scale);
 
 #endif // __TIMESTATS_H__
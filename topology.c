@@ -0,0 +1,158 @@
+/*
+ * Copyright 2015 The University of Adelaide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+
+#include "topology.h"
+#include "sysinfo.h"
+
+#define SYSCPU	"/sys/devices/system/cpu"
+
+static struct socketinfo sockets[MAX_SOCKETS];
+static int coreids[MAX_SOCKETS][MAX_CORES];
+static int nsockets = 0;
+
+static int readint(int cpu, const char *file) {
+  char name[256];
+  int rv = -1;
+  sprintf(name, SYSCPU "/cpu%d/%s", cpu, file);
+  FILE *f = fopen(name, "r");
+  if (f == NULL)
+    return -1;
+  if (fscanf(f, "%d", &rv) != 1)
+    rv = -1;
+  fclose(f);
+  return rv;
+}
+
+static int cpunode(int cpu) {
+  char name[256];
+  sprintf(name, SYSCPU "/cpu%d", cpu);
+  DIR *d = opendir(name);
+  if (d == NULL)
+    return -1;
+  int rv = -1;
+  struct dirent *de;
+  while ((de = readdir(d)) != NULL)
+    if (sscanf(de->d_name, "node%d", &rv) == 1)
+      break;
+  closedir(d);
+  return rv;
+}
+
+static struct socketinfo *getsocket(int id, int node) {
+  for (int s = 0; s < nsockets; s++)
+    if (sockets[s].id == id)
+      return &sockets[s];
+  if (nsockets == MAX_SOCKETS)
+    return NULL;
+  struct socketinfo *rv = &sockets[nsockets++];
+  rv->id = id;
+  rv->node = node;
+  rv->ncores = 0;
+  return rv;
+}
+
+static void addcpu(int cpu, int package, int core, int node) {
+  struct socketinfo *s = getsocket(package, node);
+  if (s == NULL)
+    return;
+  int *ids = coreids[s - sockets];
+  for (int c = 0; c < s->ncores; c++) {
+    if (ids[c] == core) {
+      if (s->siblings[c] == -1)
+	s->siblings[c] = cpu;
+      return;
+    }
+  }
+  if (s->ncores == MAX_CORES)
+    return;
+  ids[s->ncores] = core;
+  s->cpus[s->ncores] = cpu;
+  s->siblings[s->ncores] = -1;
+  s->ncores++;
+}
+
+static void fallback() {
+  nsockets = 0;
+  for (int c = 0; c < NCORES; c++)
+    addcpu(COREID(c), 0, c, -1);
+  for (int c = 0; c < NCORES; c++)
+    sockets[0].siblings[c] = COREID(c) + 1;
+}
+
+int topo_init() {
+  nsockets = 0;
+  long ncpus = sysconf(_SC_NPROCESSORS_CONF);
+  for (int cpu = 0; cpu < ncpus; cpu++) {
+    int package = readint(cpu, "topology/physical_package_id");
+    int core = readint(cpu, "topology/core_id");
+    if (package < 0 || core < 0)
+      continue;
+    addcpu(cpu, package, core, cpunode(cpu));
+  }
+  if (nsockets == 0)
+    fallback();
+  return nsockets;
+}
+
+uint64_t topo_llcsize() {
+  char name[256];
+  sprintf(name, SYSCPU "/cpu0/cache/index3/size");
+  FILE *f = fopen(name, "r");
+  unsigned long long kb = 0;
+  if (f != NULL) {
+    if (fscanf(f, "%lluK", &kb) != 1)
+      kb = 0;
+    fclose(f);
+  }
+  return kb * KB;
+}
+
+int topo_synthetic(int ncores) {
+  nsockets = 0;
+  for (int c = 0; c < ncores && c < MAX_CORES; c++)
+    addcpu(c, 0, c, -1);
+  return nsockets;
+}
+
+int topo_nways() {
+  int rv = readint(0, "cache/index3/ways_of_associativity");
+  return rv > 0 ? rv : NWAYS;
+}
+
+int topo_nsockets() {
+  return nsockets;
+}
+
+struct socketinfo *topo_socket(int s) {
+  if (s < 0 || s >= nsockets)
+    return NULL;
+  return &sockets[s];
+}
+
+int topo_cpusocket(int cpu) {
+  for (int s = 0; s < nsockets; s++)
+    for (int c = 0; c < sockets[s].ncores; c++)
+      if (sockets[s].cpus[c] == cpu || sockets[s].siblings[c] == cpu)
+	return s;
+  return -1;
+}
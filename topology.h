@@ -0,0 +1,50 @@
+/*
+ * Copyright 2015 The University of Adelaide
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __TOPOLOGY_H__
+#define __TOPOLOGY_H__ 1
+
+#define MAX_SOCKETS	8
+#define MAX_CORES	64
+
+/*one physical package, each with its own LLC*/
+struct socketinfo {
+  int id;                   /*physical package id*/
+  int node;                 /*NUMA node, -1 if unknown*/
+  int ncores;               /*num of physical cores*/
+  int cpus[MAX_CORES];      /*first hardware thread of each core*/
+  int siblings[MAX_CORES];  /*other hardware thread of each core, -1 if none*/
+};
+
+// Reads the topology from sysfs, falls back to NCORES/COREID from sysinfo.h
+int topo_init();
+
+// One socket of ncores cores numbered from 0, for the simulator
+int topo_synthetic(int ncores);
+
+int topo_nsockets();
+struct socketinfo *topo_socket(int s);
+
+// LLC associativity, NWAYS if sysfs does not report it
+int topo_nways();
+
+// LLC capacity in bytes, 0 if sysfs does not report it
+uint64_t topo_llcsize();
+
+// Index of the socket cpu belongs to, -1 if unknown
+int topo_cpusocket(int cpu);
+
+#endif // __TOPOLOGY_H__